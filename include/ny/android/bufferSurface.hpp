@@ -21,6 +21,7 @@ public:
 	~AndroidBufferSurface();
 
 	BufferGuard buffer() override;
+	std::vector<ImageFormat> formats() const override { return {ImageFormat::rgba8888}; }
 
 protected:
 	void apply(const BufferGuard&) noexcept override;
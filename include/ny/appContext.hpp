@@ -6,9 +6,12 @@
 
 #include <ny/fwd.hpp>
 #include <nytl/nonCopyable.hpp> // nytl::NonCopyable
+#include <nytl/connection.hpp> // nytl::Connection
 
 #include <memory> // std::unique_ptr
 #include <vector> // std::vector
+#include <chrono> // std::chrono::nanoseconds
+#include <functional> // std::function
 
 namespace ny {
 
@@ -81,6 +84,19 @@ public:
 	/// occured. The AppContext should then no longer be used.
 	virtual bool dispatchLoop(LoopControl& control) = 0;
 
+	/// Calls the given function from the ui thread once the given duration has passed.
+	/// If repeat is true, the function is called every duration until the returned
+	/// connection is disconnected (which also cancels a timer that has not expired yet).
+	/// Timers are only called while dispatching events (i.e. from dispatchEvents or
+	/// dispatchLoop) which wakes up for them, so they can e.g. drive animations
+	/// without an additional thread.
+	/// Timers expiring close to each other may be called together.
+	/// Returns an empty connection if the backend does not support timers.
+	/// Backends that do throw std::invalid_argument for negative durations or
+	/// repeating timers without duration.
+	virtual nytl::Connection timer(std::chrono::nanoseconds, std::function<void()>,
+		bool /*repeat*/ = false) { return {}; }
+
 	/// Sets the clipboard to the data provided by the given DataSource implementation.
 	/// \param dataSource a DataSource implementation for the data to copy.
 	/// The data may be directly copied from the DataSource and the given object be destroyed,
@@ -7,6 +7,12 @@
 #include <ny/fwd.hpp>
 #include <ny/image.hpp> // ny::MutableImage
 #include <nytl/nonCopyable.hpp> // nytl::NonCopyable
+#include <nytl/rect.hpp> // nytl::Rect2ui
+
+#include <vector> // std::vector
+#include <array> // std::array
+#include <memory> // std::unique_ptr
+#include <algorithm> // std::min
 
 namespace ny {
 
@@ -29,6 +35,24 @@ public:
 	/// \sa BufferGuard
 	virtual BufferGuard	buffer() = 0;
 
+	/// Returns the formats in which this surface can provide buffers without
+	/// having to convert them. The first one is the format buffer() currently uses.
+	/// To draw in any other format, ConvertingBufferSurface can be used.
+	virtual std::vector<ImageFormat> formats() const = 0;
+
+	/// Sets the size of the buffers relative to the size of the window, i.e. the
+	/// resolution at which the contents are rendered. They are scaled to the
+	/// window size when applied, so this can be used to trade resolution for speed
+	/// (e.g. 0.5 means rendering only a quarter of the pixels).
+	/// Takes effect with the next call to buffer(), so it can be changed every frame.
+	/// Returns false if the surface does not support scaling, in which case the
+	/// buffers always have the size of the window.
+	/// Throws std::invalid_argument if scale is not positive.
+	virtual bool renderScale(float scale);
+
+	/// Returns the current render scale, always 1 if it is not supported.
+	virtual float renderScale() const { return 1.f; }
+
 	//TODO: some way to query (if) currently active BufferGuard?
 	//TODO: some way to query size?
 	//TODO: just pass an Image with the surface contents directly?
@@ -51,7 +75,9 @@ protected:
 /// e.g. when wrapped in a smart pointer.
 class BufferGuard : public nytl::NonCopyable {
 public:
-	BufferGuard(BufferSurface& surf, const MutableImage& img) : surface_(surf), img_(img) {}
+	BufferGuard(BufferSurface& surf, const MutableImage& img, unsigned int age = 0,
+		nytl::Vec2ui windowSize = {}) : surface_(surf), img_(img), age_(age),
+			windowSize_(windowSize[0] && windowSize[1] ? windowSize : img.size) {}
 	~BufferGuard() { surface_.apply(*this); }
 
 	BufferGuard(BufferGuard&&) noexcept = default;
@@ -74,9 +100,94 @@ public:
 	/// \sa BufferSurface
 	BufferSurface& bufferSurface() const & { return surface_; }
 
+	/// Marks the given rect of the buffer as changed.
+	/// If damage was added, backends may only apply the damaged regions of the buffer
+	/// (e.g. only upload those), so everything inside them must be drawn, the
+	/// contents outside of them might not be used at all.
+	/// If no damage is added at all, the whole buffer is applied.
+	/// Rects are clipped to the size of the buffer, empty ones are ignored.
+	/// \sa diffRegion
+	void damage(const nytl::Rect2ui& rect)
+	{
+		fullDamage_ = false;
+		auto& size = img_.size;
+		if(rect.position[0] >= size[0] || rect.position[1] >= size[1]) return;
+
+		auto clipped = rect;
+		clipped.size[0] = std::min(rect.size[0], size[0] - rect.position[0]);
+		clipped.size[1] = std::min(rect.size[1], size[1] - rect.position[1]);
+		if(clipped.size[0] && clipped.size[1]) damage_.push_back(clipped);
+	}
+
+	/// Returns the damage rects added to this guard.
+	/// Should only be used if fullDamage returns false.
+	const std::vector<nytl::Rect2ui>& damage() const { return damage_; }
+
+	/// Returns whether the whole buffer should be applied, i.e. no damage was added.
+	bool fullDamage() const { return fullDamage_; }
+
+	/// Returns the age of the buffer, i.e. the number of frames since its contents
+	/// were applied, like EGL_EXT_buffer_age. 1 means that it holds the contents of the
+	/// previous frame, 2 of the frame before that and so on.
+	/// 0 means that the contents are undefined and everything has to be redrawn.
+	/// Backends that don't track the age always return 0.
+	/// When the BufferSurface was created with BufferSurfaceSettings::preserveContents
+	/// and the backend supports it, this is always 1 or 0.
+	unsigned int age() const { return age_; }
+
+	/// Returns the size of the window the buffer will be shown on.
+	/// Differs from the size of the buffer (get().size) if the buffer is rendered
+	/// at a different resolution, see BufferSurface::renderScale.
+	nytl::Vec2ui windowSize() const { return windowSize_; }
+
 protected:
 	BufferSurface& surface_;
 	MutableImage img_;
+	std::vector<nytl::Rect2ui> damage_;
+	bool fullDamage_ {true};
+	unsigned int age_ {};
+	nytl::Vec2ui windowSize_ {};
+};
+
+/// BufferSurface that provides buffers in a fixed format for any other BufferSurface.
+/// If the wrapped surface supports the format natively (see BufferSurface::formats),
+/// its BufferGuards are just passed through.
+/// Otherwise the content is drawn into an own buffer that is kept between frames
+/// (so its BufferGuards have an age of 1 as long as the size does not change) and
+/// only the damaged regions are converted into the buffer of the wrapped surface
+/// when it is applied.
+class ConvertingBufferSurface : public nytl::NonMovable, public BufferSurface {
+public:
+	/// The number of frames whose damage is remembered, if the buffer of the wrapped
+	/// surface is older, it is converted completely.
+	static constexpr auto damageHistory = 4u;
+
+public:
+	ConvertingBufferSurface(BufferSurface& surface, ImageFormat format);
+	~ConvertingBufferSurface() = default;
+
+	BufferGuard buffer() override;
+	std::vector<ImageFormat> formats() const override { return {format_}; }
+	bool renderScale(float scale) override { return surface_->renderScale(scale); }
+	float renderScale() const override { return surface_->renderScale(); }
+
+	/// Returns whether the formats differ, i.e. whether contents are converted.
+	bool converting() const { return converting_; }
+	BufferSurface& surface() const { return *surface_; }
+	ImageFormat format() const { return format_; }
+
+protected:
+	void apply(const BufferGuard&) noexcept override;
+
+protected:
+	BufferSurface* surface_ {};
+	ImageFormat format_ {};
+	bool converting_ {};
+
+	UniqueImage buffer_ {};
+	std::unique_ptr<BufferGuard> guard_; // the active guard of the wrapped surface
+	unsigned int frame_ {}; // number of applied frames
+	std::array<std::vector<nytl::Rect2ui>, damageHistory> damage_; // per frame, ring buffer
 };
 
 } // namespace ny
@@ -0,0 +1,67 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <ny/loopControl.hpp> // ny::LoopFunction
+#include <nytl/nonCopyable.hpp> // nytl::NonMovable
+
+#include <atomic> // std::atomic
+#include <mutex> // std::mutex
+#include <memory> // std::unique_ptr
+#include <vector> // std::vector
+#include <cstddef> // std::size_t
+
+namespace ny {
+
+/// Queue of functions that are pushed from any thread and called from one
+/// consumer thread. Used by the unix LoopInterface implementations.
+/// Functions are stored in a bounded lock-free ring, so pushing them does neither
+/// lock nor allocate (as long as the function fits into a LoopFunction).
+/// If the ring is full, functions are pushed into a mutex-protected overflow list,
+/// so push never blocks, not even when called from the consumer thread.
+/// Functions pushed from the same thread are called in the order they were pushed.
+class CallQueue : public nytl::NonMovable {
+public:
+	static constexpr std::size_t capacity = 1024u; // must be a power of two
+
+public:
+	CallQueue();
+	~CallQueue();
+
+	/// Queues the given function. Can be called from any thread.
+	/// Returns whether the consumer has to be woken up, i.e. whether this
+	/// is the first function queued since the consumer last called run.
+	bool push(LoopFunction&& func);
+
+	/// Calls all queued functions. Must only be called from the consumer thread.
+	/// Returns the number of called functions.
+	unsigned int run();
+
+protected:
+	bool tryPush(LoopFunction& func);
+	bool tryPop(LoopFunction& func);
+
+protected:
+	struct Cell {
+		std::atomic<std::size_t> sequence;
+		LoopFunction func;
+	};
+
+	std::unique_ptr<Cell[]> cells_;
+
+	// producers and consumer on different cache lines
+	alignas(64) std::atomic<std::size_t> tail_ {0u};
+	alignas(64) std::size_t head_ {0u}; // only used by the consumer
+	alignas(64) std::atomic<bool> signaled_ {false};
+
+	// functions that did not fit into the ring
+	std::atomic<bool> overflowing_ {false};
+	std::mutex overflowMutex_;
+	std::vector<LoopFunction> overflow_;
+	std::vector<LoopFunction> batch_; // taken from overflow_, only used by the consumer
+	std::size_t batchPos_ {}; // the next function in batch_ to call
+};
+
+} // namespace ny
@@ -0,0 +1,55 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <nytl/connection.hpp> // nytl::Connectable
+
+#include <vector> // std::vector
+#include <cstdint> // std::uintptr_t
+
+namespace ny {
+
+/// Utility template that allows a generic list of connectable objects.
+/// Used by the unix AppContexts for their fd listeners.
+template<typename T>
+class ConnectionList : public nytl::Connectable {
+public:
+	struct Value : public T {
+		using T::T;
+		nytl::ConnectionID clID_;
+	};
+
+	std::vector<Value> items;
+	nytl::ConnectionID highestID;
+
+public:
+	bool disconnect(const nytl::ConnectionID& id) override
+	{
+		for(auto it = items.begin(); it != items.end(); ++it) {
+			if(it->clID_ == id) {
+				items.erase(it);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	nytl::Connection add(const T& value)
+	{
+		items.emplace_back();
+		static_cast<T&>(items.back()) = value;
+		items.back().clID_ = nextID();
+		return {*this, items.back().clID_};
+	}
+
+	nytl::ConnectionID nextID()
+	{
+		++reinterpret_cast<std::uintptr_t&>(highestID);
+		return highestID;
+	}
+};
+
+} // namespace ny
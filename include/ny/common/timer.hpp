@@ -0,0 +1,66 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <nytl/connection.hpp> // nytl::Connectable
+#include <nytl/nonCopyable.hpp> // nytl::NonMovable
+
+#include <chrono> // std::chrono
+#include <functional> // std::function
+#include <vector> // std::vector
+
+namespace ny {
+
+/// List of timers that share a single timerfd.
+/// The timerfd is always armed for the earliest deadline. When it expires, all timers
+/// that expire within coalesceWindow are called as well so that timers with close
+/// deadlines only cause one wakeup.
+/// Used by the unix AppContexts to implement AppContext::timer: they poll fd()
+/// and call dispatch() when it is readable.
+class TimerQueue : public nytl::Connectable, public nytl::NonMovable {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	/// Timers expiring at most this much later than the current time are
+	/// called together with the expired ones.
+	static constexpr auto coalesceWindow = std::chrono::microseconds(500);
+
+public:
+	/// Throws std::system_error if the timerfd cannot be created.
+	TimerQueue();
+	~TimerQueue();
+
+	/// Adds a timer that calls the given function after the given duration and,
+	/// if repeat is true, every duration after that.
+	/// Throws std::invalid_argument for negative durations or repeating timers
+	/// without duration.
+	nytl::Connection add(std::chrono::nanoseconds duration, std::function<void()> func,
+		bool repeat);
+	bool disconnect(const nytl::ConnectionID&) override;
+
+	/// Calls all expired timers, should be called when fd() is readable.
+	void dispatch();
+
+	/// The timerfd. Owned by this object.
+	int fd() const { return fd_; }
+
+protected:
+	struct Timer {
+		Clock::time_point deadline;
+		std::chrono::nanoseconds interval; // 0 for one-shot timers
+		std::function<void()> func;
+		nytl::ConnectionID id;
+	};
+
+	/// Arms the timerfd for the earliest deadline or disarms it if there are no timers.
+	void arm();
+
+protected:
+	std::vector<Timer> timers_;
+	nytl::ConnectionID highestID_ {};
+	int fd_ {-1};
+};
+
+} // namespace ny
@@ -5,9 +5,13 @@
 #pragma once
 
 #include <nytl/vec.hpp> // nytl::Vec
+#include <nytl/rect.hpp> // nytl::Rect
 #include <memory> // std::unique_ptr
 #include <cstring> // std::memcpy
 #include <array> // std::array
+#include <vector> // std::vector
+#include <functional> // std::function
+#include <stdexcept> // std::out_of_range
 
 namespace ny {
 
@@ -35,6 +39,55 @@ enum class ImageFormat : unsigned int
 	a1 // 1-bit alpha
 };
 
+/// Describes the pixel layout of an ImageFormat.
+/// A pixel is seen as one word (in word order, see BasicImage) of the given size in bits.
+/// For every channel (indexed r, g, b, a) shift holds the position of its least
+/// significant bit in that word and size its number of bits. Channels a format
+/// does not have are of size 0.
+/// Example: argb8888 has bits 32, shift {16, 8, 0, 24} and size {8, 8, 8, 8}.
+struct FormatInfo {
+	unsigned int bits;
+	std::array<unsigned int, 4> shift;
+	std::array<unsigned int, 4> size;
+};
+
+/// The FormatInfo of every ImageFormat, indexed by the enumeration value.
+/// This is the only description of the formats, everything else is derived from it.
+inline constexpr FormatInfo formatInfos[] = {
+	{0, {0, 0, 0, 0}, {0, 0, 0, 0}}, // none
+
+	{32, {24, 16, 8, 0}, {8, 8, 8, 8}}, // rgba8888
+	{32, {16, 8, 0, 24}, {8, 8, 8, 8}}, // argb8888
+	{24, {16, 8, 0, 0}, {8, 8, 8, 0}}, // rgb888
+
+	{32, {0, 8, 16, 24}, {8, 8, 8, 8}}, // abgr8888
+	{32, {8, 16, 24, 0}, {8, 8, 8, 8}}, // bgra8888
+	{24, {0, 8, 16, 0}, {8, 8, 8, 0}}, // bgr888
+
+	{8, {0, 0, 0, 0}, {0, 0, 0, 8}}, // a8
+	{1, {0, 0, 0, 0}, {0, 0, 0, 1}}, // a1
+};
+
+/// Returns the FormatInfo for the given format.
+constexpr const FormatInfo& formatInfo(ImageFormat format)
+	{ return formatInfos[static_cast<unsigned int>(format)]; }
+
+/// The number of ImageFormat enumeration values (including none).
+constexpr unsigned int formatCount = sizeof(formatInfos) / sizeof(formatInfos[0]);
+
+/// Compile-time traits of an ImageFormat, derived from its FormatInfo.
+/// Can be used to write code that is specialized for one format.
+template<ImageFormat F>
+struct FormatTraits {
+	static constexpr ImageFormat format = F;
+	static constexpr FormatInfo info = formatInfo(F);
+	static constexpr unsigned int bits = info.bits;
+	static constexpr unsigned int bytes = (bits + 7) / 8;
+	static constexpr bool byteAligned = (bits % 8) == 0;
+	static constexpr bool alpha = info.size[3] != 0;
+	static constexpr bool color = info.size[0] || info.size[1] || info.size[2];
+};
+
 /// Returns whether the current machine is little endian.
 /// If this returns false it is assumed to be big endian.
 bool littleEndian();
@@ -202,6 +255,29 @@ constexpr unsigned int dataSize(const BasicImage<P>& img)
 /// Returns the bit of the given Image at which the pixel for the given position begins.
 unsigned int pixelBit(const Image&, nytl::Vec2ui position);
 
+/// Returns a non-owning view of the given region of the given image.
+/// The view references the data of img (nothing is copied) and has the same
+/// stride, so writing into the view of a mutable image writes into img.
+/// Returns an Image for const images and a MutableImage for mutable or owned ones.
+/// Throws std::out_of_range if the region does not lie inside img and
+/// std::invalid_argument if the region would not begin at a byte boundary
+/// (only possible for formats with less than 8 bits per pixel).
+template<typename P>
+auto subImage(const BasicImage<P>& img, const nytl::Rect2ui& region)
+{
+	using Pointer = decltype(data(img));
+
+	if(region.position[0] + region.size[0] > img.size[0] ||
+			region.position[1] + region.size[1] > img.size[1])
+		throw std::out_of_range("ny::subImage: region out of range");
+
+	auto bit = bitStride(img) * region.position[1] + bitSize(img.format) * region.position[0];
+	if(bit % 8)
+		throw std::invalid_argument("ny::subImage: region does not begin at a byte");
+
+	return BasicImage<Pointer>(data(img) + bit / 8, region.size, img.format, bitStride(img));
+}
+
 /// Returns the color of the image at at the given position.
 /// The returned vector will hold the components of the colorspace of the images format.
 /// Does not perform any range checking, i.e. if position lies outside of the size
@@ -231,8 +307,9 @@ void writePixel(uint8_t& pixel, ImageFormat format, nytl::Vec4u8 color,
 	unsigned int bitOffset = 0u);
 
 /// Normalizes the given color values for the given format (color channel sizes).
-/// Example: norm({255, 128, 511, 0}, rgba8888) returns {1.0, 0.5, 2.0, 0.0}
-nytl::Vec4f norm(nytl::Vec4u64 color, ImageFormat format);
+/// Channels the format does not have are normalized as 8 bit values.
+/// Example: norm({255, 128, 0, 1}, a1) returns {1.0, 0.5, 0.0, 1.0}
+nytl::Vec4f norm(nytl::Vec4u8 color, ImageFormat format);
 
 /// Returns whether an ImageData object satisfied the given requirements.
 /// Returns false if the stride of the given ImageData satisfies the given align but
@@ -240,6 +317,27 @@ nytl::Vec4f norm(nytl::Vec4u64 color, ImageFormat format);
 /// \param strideAlign The required alignment of the stride in bits
 bool satisfiesRequirements(const Image&, ImageFormat, unsigned int strideAlign = 0);
 
+/// Controls how the parallel versions of the image operations are executed.
+/// They split the image into bands of rows and process those concurrently.
+/// Images with bit strides (that are not a multiple of 8) are always processed serially.
+struct ParallelSettings {
+	/// Calls the given task for every index in [0, count) and only returns once all
+	/// those calls have finished. The calls may be executed concurrently.
+	using Executor = std::function<void(unsigned int count,
+		const std::function<void(unsigned int)>& task)>;
+
+	/// The executor to use. If empty, a small internal thread pool is used.
+	Executor executor {};
+
+	/// Images with fewer pixels than this are processed serially on the calling thread,
+	/// since distributing them is more expensive than the operation itself.
+	unsigned int threshold {512 * 512};
+
+	/// The maximum number of bands to split an image into.
+	/// If 0, the number of hardware threads is used.
+	unsigned int bands {};
+};
+
 /// Can be used to convert image data to another format or to change its stride alignment.
 /// \param alignNewStride Can be used to pass a alignment requirement for the stride of the
 /// new (converted) data. Defaulted to 0, in which case the packed size will be used as stride.
@@ -248,13 +346,130 @@ bool satisfiesRequirements(const Image&, ImageFormat, unsigned int strideAlign =
 UniqueImage convertFormat(const Image&, ImageFormat to, unsigned int alignNewStride = 0);
 void convertFormat(const Image&, ImageFormat to, uint8_t& into, unsigned int alignNewStride = 0);
 
+/// Parallel versions of convertFormat, see ParallelSettings.
+UniqueImage convertFormat(const Image&, ImageFormat to, unsigned int alignNewStride,
+	const ParallelSettings&);
+void convertFormat(const Image&, ImageFormat to, uint8_t& into, unsigned int alignNewStride,
+	const ParallelSettings&);
+
+/// Copies the given image into dst at the given position.
+/// Works row by row and does not allocate, the rest of dst stays untouched.
+/// Throws std::invalid_argument if the formats of both images are not equal and
+/// std::out_of_range if src does not fit into dst at the given position.
+void copy(const Image& src, const MutableImage& dst, nytl::Vec2ui position = {});
+
+/// Like copy but converts from the format of src into the format of dst.
+/// Throws std::out_of_range if src does not fit into dst at the given position.
+/// \sa convertFormat
+void blit(const Image& src, const MutableImage& dst, nytl::Vec2ui position = {});
+
+/// Parallel versions of copy and blit, see ParallelSettings.
+void copy(const Image& src, const MutableImage& dst, nytl::Vec2ui position,
+	const ParallelSettings&);
+void blit(const Image& src, const MutableImage& dst, nytl::Vec2ui position,
+	const ParallelSettings&);
+
+/// Sets all pixels of the given image to the given color.
+/// The color holds the values of the image formats channels (as for writePixel).
+/// Does not touch the padding bytes at the end of each row.
+void fill(const MutableImage& img, nytl::Vec4u8 color);
+
+/// Sets all pixels in the given rect of the image to the given color.
+/// Throws std::out_of_range if the rect does not lie inside the image.
+void fillRect(const MutableImage& img, const nytl::Rect2ui& rect, nytl::Vec4u8 color);
+
+/// Parallel versions of fill and fillRect, see ParallelSettings.
+void fill(const MutableImage& img, nytl::Vec4u8 color, const ParallelSettings&);
+void fillRect(const MutableImage& img, const nytl::Rect2ui& rect, nytl::Vec4u8 color,
+	const ParallelSettings&);
+
+/// Porter-Duff compositing operations, see composite.
+enum class CompositeOp {
+	clear, // sets the destination to zero
+	src, // replaces the destination with the source
+	over // blends the source over the destination
+};
+
+/// Composites the premultiplied image src onto the premultiplied image dst at the given
+/// position using the given operation.
+/// The source is modulated with the given constant alpha value before compositing.
+/// Both images must have a 32 bit format with alpha (e.g. argb8888), they may
+/// have different formats.
+/// Throws std::invalid_argument if a format is not supported and
+/// std::out_of_range if src does not fit into dst at the given position.
+void composite(const Image& src, const MutableImage& dst, nytl::Vec2ui position = {},
+	CompositeOp op = CompositeOp::over, uint8_t alpha = 255);
+
+/// Parallel version of composite, see ParallelSettings.
+void composite(const Image& src, const MutableImage& dst, nytl::Vec2ui position,
+	CompositeOp op, uint8_t alpha, const ParallelSettings&);
+
+/// Returns the regions in which the pixels of cur differ from the ones of prev.
+/// The images are compared in square tiles of the given size (in pixels) and the
+/// returned rects are unions of tiles that differ, clamped to the image size.
+/// Neighboring dirty tiles in a tile row and runs of the same extent in consecutive
+/// tile rows are merged. If there would be more than maxRects rects (and maxRects
+/// is not 0), their bounding rect is returned instead.
+/// Useful for only damaging and uploading the changed parts of a redrawn frame.
+/// Returns an empty vector if the images are equal.
+/// Throws std::invalid_argument if the images differ in size or format.
+std::vector<nytl::Rect2ui> diffRegion(const Image& prev, const Image& cur,
+	unsigned int tileSize = 64, unsigned int maxRects = 16);
+
+/// Linear (i.e. not gamma encoded) color values with 16 bits per channel.
+/// Used as intermediate format for gamma correct operations, since 8 bits are
+/// not enough to represent linear values without visible banding.
+/// Every pixel consists of 4 values in r, g, b, a order, rows are tightly packed.
+/// Alpha is always linear, a value of 65535 is fully opaque.
+struct LinearImage {
+	std::unique_ptr<uint16_t[]> data; // size[0] * size[1] * 4 values
+	nytl::Vec2ui size {};
+};
+
+/// Decodes the sRGB encoded color values of the given image to linear values.
+/// The image must have a 24 or 32 bit format with 8 bit channels (e.g. argb8888),
+/// otherwise std::invalid_argument is thrown.
+/// Colors should not be premultiplied. Uses lookup tables, so this is cheap
+/// enough to be done for every frame.
+/// \param into Must reference at least size[0] * size[1] * 4 values.
+LinearImage decodeSrgb(const Image& img);
+void decodeSrgb(const Image& img, uint16_t& into);
+
+/// Encodes the given linear values (in the layout of LinearImage) into sRGB
+/// encoded color values of the given image. Has the same format restrictions
+/// as decodeSrgb.
+void encodeSrgb(const uint16_t& linear, const MutableImage& img);
+
+/// Converts the color values of the given image from sRGB to linear or the other way
+/// around in place. Has the same format restrictions as decodeSrgb.
+/// Note that storing linear values with 8 bits loses precision in dark colors,
+/// prefer decodeSrgb for anything that is encoded again later on.
+void srgbToLinear(const MutableImage& img);
+void linearToSrgb(const MutableImage& img);
+
 /// Returns whether the given format has an alpha component.
 /// Despite the name, this will return false for the a1 and a8 image formats.
 bool alphaComponent(ImageFormat);
 
 /// Premutliplies the alpha factors for the given image.
+/// Every color channel c is set to round(c * alpha / 255) (for 8 bit channels),
+/// computed with exact integer arithmetic.
 /// Has no effect if the given image has no alpha channel or only an alpha channel.
 /// \param resetAlpha Sets all alpha values to zero why premultiplying if true.
 void premultiply(const MutableImage& img, bool resetAlpha = false);
 
+/// Parallel version of premultiply, see ParallelSettings.
+void premultiply(const MutableImage& img, bool resetAlpha, const ParallelSettings&);
+
+/// Reverts premultiply, i.e. sets every color channel c to round(c * 255 / alpha)
+/// (for 8 bit channels). Color values of pixels with an alpha value of 0 are set to 0,
+/// color values larger than their alpha value are clamped.
+/// Note that premultiplying loses precision for small alpha values, so this
+/// will not restore the original colors exactly.
+/// Has no effect if the given image has no alpha channel or only an alpha channel.
+void unpremultiply(const MutableImage& img);
+
+/// Parallel version of unpremultiply, see ParallelSettings.
+void unpremultiply(const MutableImage& img, const ParallelSettings&);
+
 } // namespace nytl
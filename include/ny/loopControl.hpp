@@ -7,14 +7,57 @@
 #include <ny/fwd.hpp>
 #include <nytl/nonCopyable.hpp> // nytl::NonCopyable
 
-#include <functional> // std::function
-#include <mutex> // std::atomic
+#include <atomic> // std::atomic
+#include <thread> // std::this_thread::yield
+#include <new> // placement new
+#include <cstddef> // std::max_align_t
+#include <type_traits> // std::decay_t
+#include <utility> // std::move
 
 // header-only implementation.
 // can be used independently in other projects
 
 namespace ny {
 
+/// Move-only type-erased `void()` callable that stores small functions inline.
+/// Used for functions queued with LoopControl::call so that queueing them does not
+/// have to allocate. Functions larger than inlineSize (or that cannot be moved
+/// without throwing) are stored on the heap.
+/// Can be constructed from any callable, including std::function (an empty
+/// std::function results in an empty LoopFunction).
+class LoopFunction {
+public:
+	static constexpr auto inlineSize = 6 * sizeof(void*);
+
+public:
+	LoopFunction() = default;
+	~LoopFunction() { reset(); }
+
+	template<typename F, typename = std::enable_if_t<
+		!std::is_same<std::decay_t<F>, LoopFunction>::value>>
+	LoopFunction(F&& func);
+
+	LoopFunction(LoopFunction&& other) noexcept { *this = std::move(other); }
+	inline LoopFunction& operator=(LoopFunction&& other) noexcept;
+
+	void operator()() { ops_->call(storage_); }
+	explicit operator bool() const { return ops_; }
+	inline void reset() noexcept;
+
+protected:
+	struct Ops {
+		void (*call)(void*);
+		void (*move)(void* dst, void* src) noexcept; // move constructs, destroys src
+		void (*destroy)(void*) noexcept;
+	};
+
+	template<typename F> struct InlineOps;
+	template<typename F> struct HeapOps;
+
+	alignas(std::max_align_t) unsigned char storage_[inlineSize];
+	const Ops* ops_ {};
+};
+
 /// Abstract base interface for LoopControl implementations.
 /// Implemented by functions running loops that can be stopped or for which can additional
 /// functions be queued even from other threads.
@@ -36,12 +79,20 @@ public:
 
 	/// Should call the given function in the next loop iteration from the loop thread.
 	/// Must be implemented threadsafe, and work if called from within the loop.
-	virtual bool call(std::function<void()>) { return false; }
+	/// Should not block since it is called from LoopControl::call, which
+	/// makes destroying the LoopInterface wait for it.
+	virtual bool call(LoopFunction&&) { return false; }
 
 protected:
 	inline LoopInterface(LoopControl& lc);
 	inline virtual ~LoopInterface();
 
+	/// Resets the LoopControl and waits until no other thread uses this object anymore.
+	/// Implementations should call this at the beginning of their destructor, since
+	/// otherwise their members might already be destroyed while being used by
+	/// another thread. Called by the destructor if it wasn't called before.
+	inline void detach();
+
 private:
 	LoopInterface() = default;
 	LoopControl* control_ {};
@@ -56,6 +107,8 @@ private:
 /// in undefined behaviour (requiring a threadsafe LoopInterface implementation).
 /// If the loop is currently waiting/blocking for events calling member functions of the
 /// associated LoopControl object will wake up the loop.
+/// Calling stop or call does not lock any mutex, see the implementation notes at the
+/// end of this file.
 class LoopControl : public nytl::NonMovable {
 public:
 	LoopControl() = default;
@@ -71,23 +124,30 @@ public:
 	/// Functions are guaranteed to be called in the order they are queued here.
 	/// Returns false if this LoopControl object is invalid or queueing the function failed.
 	/// Will not wait for the function to be executed or finish.
-	inline bool call(std::function<void()> func);
+	/// Small functions (see LoopFunction) are queued without any allocation.
+	inline bool call(LoopFunction func);
 
 	/// Returns whether this object is valied, i.e. whether it member functions will
 	/// have any effect.
 	/// If this returns false all member functions are guaranteed to return false.
 	/// Note that this cannot really be used in any meaningful context since the
 	/// LoopControl might be reset from another thread.
-	bool valid() const { return &impl() != &LoopInterface::dummy(); }
+	bool valid() const { return impl_.load() != &LoopInterface::dummy(); }
 
 protected:
 	friend class LoopInterface;
+
+	/// Sets the implementation and waits until no thread uses the old one anymore.
 	inline void impl(LoopInterface& impl);
-	inline LoopInterface& impl() const;
+
+	/// Calls the given function with the current implementation which is
+	/// guaranteed to stay alive during the call.
+	template<typename F> bool use(F&& func);
 
 protected:
-	std::reference_wrapper<LoopInterface> impl_ {LoopInterface::dummy()};
-	mutable std::mutex mutex_; // use shared mutex?
+	std::atomic<LoopInterface*> impl_ {&LoopInterface::dummy()};
+	std::atomic<unsigned int> epoch_ {0u};
+	std::atomic<unsigned int> users_[2] {}; // number of callers per epoch parity
 };
 
 // - inline implementation -
@@ -98,47 +158,134 @@ LoopInterface::LoopInterface(LoopControl& lc) : control_(&lc)
 
 LoopInterface::~LoopInterface()
 {
-	if(control_)
-		control_->impl(LoopInterface::dummy());
+	detach();
+}
+
+void LoopInterface::detach()
+{
+	if(control_) control_->impl(LoopInterface::dummy());
+	control_ = nullptr;
 }
 
 void LoopControl::impl(LoopInterface& li)
 {
-	std::lock_guard<std::mutex> lock(mutex_);
-	impl_ = li;
+	// callers that might have loaded the old impl are counted in the old epoch
+	impl_.store(&li);
+	auto old = epoch_.fetch_add(1u) % 2;
+	while(users_[old].load() != 0u) std::this_thread::yield();
 }
 
-LoopInterface& LoopControl::impl() const
+template<typename F>
+bool LoopControl::use(F&& func)
 {
-	std::lock_guard<std::mutex> lock(mutex_);
-	return impl_.get();
+	// register in the counter of the current epoch. If the epoch changed in the
+	// meantime, the impl change might not have waited for us, so try again
+	auto epoch = epoch_.load();
+	users_[epoch % 2].fetch_add(1u);
+	while(epoch_.load() != epoch) {
+		users_[epoch % 2].fetch_sub(1u);
+		epoch = epoch_.load();
+		users_[epoch % 2].fetch_add(1u);
+	}
+
+	struct Guard {
+		std::atomic<unsigned int>& users;
+		~Guard() { users.fetch_sub(1u); }
+	} guard {users_[epoch % 2]};
+
+	return func(*impl_.load());
 }
 
 bool LoopControl::stop()
 {
-	std::lock_guard<std::mutex> lock(mutex_);
-	return impl_.get().stop();
+	return use([&](LoopInterface& impl) { return impl.stop(); });
+}
+
+bool LoopControl::call(LoopFunction func)
+{
+	if(!func) return false;
+	return use([&](LoopInterface& impl) { return impl.call(std::move(func)); });
+}
+
+// LoopFunction
+template<typename F>
+struct LoopFunction::InlineOps {
+	static void call(void* ptr) { (*static_cast<F*>(ptr))(); }
+	static void move(void* dst, void* src) noexcept
+	{
+		new(dst) F(std::move(*static_cast<F*>(src)));
+		static_cast<F*>(src)->~F();
+	}
+	static void destroy(void* ptr) noexcept { static_cast<F*>(ptr)->~F(); }
+	static constexpr Ops ops {call, move, destroy};
+};
+
+template<typename F>
+struct LoopFunction::HeapOps {
+	static void call(void* ptr) { (**static_cast<F**>(ptr))(); }
+	static void move(void* dst, void* src) noexcept { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+	static void destroy(void* ptr) noexcept { delete *static_cast<F**>(ptr); }
+	static constexpr Ops ops {call, move, destroy};
+};
+
+template<typename F> constexpr LoopFunction::Ops LoopFunction::InlineOps<F>::ops;
+template<typename F> constexpr LoopFunction::Ops LoopFunction::HeapOps<F>::ops;
+
+template<typename F, typename>
+LoopFunction::LoopFunction(F&& func)
+{
+	using T = std::decay_t<F>;
+	if constexpr(std::is_constructible<bool, const T&>::value) {
+		if(!static_cast<bool>(func)) return;
+	}
+
+	if constexpr(sizeof(T) <= inlineSize && alignof(T) <= alignof(std::max_align_t) &&
+			std::is_nothrow_move_constructible<T>::value) {
+		new(storage_) T(std::forward<F>(func));
+		ops_ = &InlineOps<T>::ops;
+	} else {
+		*reinterpret_cast<T**>(storage_) = new T(std::forward<F>(func));
+		ops_ = &HeapOps<T>::ops;
+	}
+}
+
+LoopFunction& LoopFunction::operator=(LoopFunction&& other) noexcept
+{
+	if(&other == this) return *this;
+
+	reset();
+	if(other.ops_) {
+		other.ops_->move(storage_, other.storage_);
+		ops_ = other.ops_;
+		other.ops_ = nullptr;
+	}
+
+	return *this;
 }
 
-bool LoopControl::call(std::function<void()> func)
+void LoopFunction::reset() noexcept
 {
-	std::lock_guard<std::mutex> lock(mutex_);
-	return impl_.get().call(std::move(func));
+	if(ops_) ops_->destroy(storage_);
+	ops_ = nullptr;
 }
 
-/// NOTE: a few implementation detilas on LoopControl
-/// It is required to synchronize it with a mutex (an atomic impl pointer is not enough)
-/// since it has to be assured that the impl cannot be changed (usually reset)
-/// while an impl function is called.
-/// Must/should be even threadsafe in the following case:
+/// NOTE: a few implementation details on LoopControl
+/// It has to be assured that the impl cannot be destroyed while an impl function
+/// is called, i.e. this must be threadsafe:
 /// - the loop has ended, i.e. resets the LoopControl impl
 /// - another thread calls stop/call
 /// - the implementation might be destroyed while another thread is still calling
 ///	  a member function
-/// - the mutex guards an impl change as well as the impl functions so it can be
-/// assured that this scenario works.
-/// The cost of this might be a blocking LoopControl::impl and therefore a
+/// Callers therefore register themselves in a counter before loading the impl.
+/// Changing the impl stores the new one and then waits until all callers that
+/// might still use the old one are done.
+/// There are two counters which are used alternately (epoch_) so that waiting
+/// only has to wait for the callers that started before the impl change and
+/// continuous calls from other threads cannot delay it indefinitely.
+/// Callers check that the epoch did not change after registering, otherwise they
+/// might be counted in the counter of an older epoch no one waits for.
+/// The cost of this is a (shortly) blocking LoopControl::impl and therefore a
 /// blocking LoopInterface destructor. But since the impl functions that might
-/// be waited on should not block themselves it should not be a problem
+/// be waited on should not block themselves it should not be a problem.
 
 } // namespace ny
@@ -21,6 +21,7 @@
 #include <ny/mouseButton.hpp>
 #include <ny/mouseContext.hpp>
 #include <ny/nativeHandle.hpp>
+#include <ny/pixelView.hpp>
 #include <ny/surface.hpp>
 #include <ny/windowContext.hpp>
 #include <ny/windowListener.hpp>
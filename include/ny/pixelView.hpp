@@ -0,0 +1,235 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <ny/image.hpp> // ny::ImageFormat, ny::FormatTraits
+
+#include <cstdint> // std::uint32_t
+#include <cstring> // std::memcpy
+#include <cstddef> // std::ptrdiff_t
+#include <stdexcept> // std::invalid_argument
+
+// Typed pixel access for images whose format is known at compile time.
+// Everything here is header-only and inline, so that code written against it
+// compiles down to plain loads, shifts and stores (which the compiler can vectorize).
+
+namespace ny {
+namespace detail {
+
+/// Whether the machine stores words in little endian order, known at compile time.
+/// Compilers that don't define __BYTE_ORDER__ (msvc) only target little endian machines.
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	constexpr bool nativeLittleEndian = false;
+#else
+	constexpr bool nativeLittleEndian = true;
+#endif
+
+constexpr uint32_t bitMask(unsigned int bits)
+	{ return bits >= 32 ? 0xFFFFFFFFu : (1u << bits) - 1; }
+
+/// Loads/Stores a pixel word of the given size in bytes from/to memory.
+/// Words are in native order, so 2 and 4 byte words are just plain loads.
+template<unsigned int Bytes>
+inline uint32_t loadWord(const uint8_t* ptr)
+{
+	static_assert(Bytes >= 1 && Bytes <= 4);
+	if constexpr(Bytes == 4) {
+		uint32_t word;
+		std::memcpy(&word, ptr, 4);
+		return word;
+	} else if constexpr(Bytes == 2) {
+		uint16_t word;
+		std::memcpy(&word, ptr, 2);
+		return word;
+	} else if constexpr(Bytes == 3) {
+		uint32_t first = ptr[nativeLittleEndian ? 0 : 2];
+		uint32_t second = ptr[1];
+		uint32_t third = ptr[nativeLittleEndian ? 2 : 0];
+		return first | (second << 8) | (third << 16);
+	} else {
+		return *ptr;
+	}
+}
+
+template<unsigned int Bytes>
+inline void storeWord(uint8_t* ptr, uint32_t word)
+{
+	static_assert(Bytes >= 1 && Bytes <= 4);
+	if constexpr(Bytes == 4) {
+		std::memcpy(ptr, &word, 4);
+	} else if constexpr(Bytes == 2) {
+		auto half = static_cast<uint16_t>(word);
+		std::memcpy(ptr, &half, 2);
+	} else if constexpr(Bytes == 3) {
+		ptr[nativeLittleEndian ? 0 : 2] = word;
+		ptr[1] = word >> 8;
+		ptr[nativeLittleEndian ? 2 : 0] = word >> 16;
+	} else {
+		*ptr = word;
+	}
+}
+
+} // namespace detail
+
+/// Packs and unpacks pixels of the byte aligned format F.
+/// Color values are always given in the channel sizes of the format (as for
+/// readPixel/writePixel), channels the format does not have are ignored when
+/// packing and read as 0 (or 255 for alpha) when unpacking.
+template<ImageFormat F>
+struct PixelFormat {
+	using Traits = FormatTraits<F>;
+	static_assert(Traits::bits && Traits::byteAligned, "Only for byte aligned formats");
+
+	static constexpr unsigned int bytes = Traits::bytes;
+
+	/// Returns the pixel word for the given color.
+	static constexpr uint32_t pack(nytl::Vec4u8 color)
+	{
+		uint32_t word = 0u;
+		for(auto c = 0u; c < 4u; ++c) {
+			if(!Traits::info.size[c]) continue;
+			auto value = color[c] & detail::bitMask(Traits::info.size[c]);
+			word |= value << Traits::info.shift[c];
+		}
+
+		return word;
+	}
+
+	/// Returns the color of the given pixel word.
+	static nytl::Vec4u8 unpack(uint32_t word)
+	{
+		nytl::Vec4u8 color {0, 0, 0, 255};
+		for(auto c = 0u; c < 4u; ++c) {
+			if(!Traits::info.size[c]) continue;
+			color[c] = (word >> Traits::info.shift[c]) & detail::bitMask(Traits::info.size[c]);
+		}
+
+		return color;
+	}
+
+	static uint32_t load(const uint8_t* ptr) { return detail::loadWord<bytes>(ptr); }
+	static void store(uint8_t* ptr, uint32_t word) { detail::storeWord<bytes>(ptr, word); }
+
+	static nytl::Vec4u8 read(const uint8_t* ptr) { return unpack(load(ptr)); }
+	static void write(uint8_t* ptr, nytl::Vec4u8 color) { store(ptr, pack(color)); }
+};
+
+/// Reference to a single pixel of format F.
+/// Byte is either uint8_t or const uint8_t for read-only access.
+template<ImageFormat F, typename Byte = uint8_t>
+class PixelRef {
+public:
+	using Format = PixelFormat<F>;
+	Byte* ptr;
+
+public:
+	nytl::Vec4u8 color() const { return Format::read(ptr); }
+	uint32_t word() const { return Format::load(ptr); }
+	operator nytl::Vec4u8() const { return color(); }
+
+	void color(nytl::Vec4u8 color) const { Format::write(ptr, color); }
+	void word(uint32_t word) const { Format::store(ptr, word); }
+	const PixelRef& operator=(nytl::Vec4u8 value) const { color(value); return *this; }
+};
+
+/// Iterator over the pixels of a row. Dereferencing it returns a PixelRef.
+template<ImageFormat F, typename Byte = uint8_t>
+class PixelIterator {
+public:
+	using Format = PixelFormat<F>;
+	Byte* ptr;
+
+public:
+	PixelRef<F, Byte> operator*() const { return {ptr}; }
+	PixelRef<F, Byte> operator[](std::ptrdiff_t i) const { return {ptr + i * Format::bytes}; }
+
+	PixelIterator& operator++() { ptr += Format::bytes; return *this; }
+	PixelIterator& operator--() { ptr -= Format::bytes; return *this; }
+	PixelIterator& operator+=(std::ptrdiff_t i) { ptr += i * Format::bytes; return *this; }
+	PixelIterator& operator-=(std::ptrdiff_t i) { ptr -= i * Format::bytes; return *this; }
+	PixelIterator operator++(int) { auto cpy = *this; ++(*this); return cpy; }
+	PixelIterator operator+(std::ptrdiff_t i) const { return {ptr + i * Format::bytes}; }
+	PixelIterator operator-(std::ptrdiff_t i) const { return {ptr - i * Format::bytes}; }
+	std::ptrdiff_t operator-(const PixelIterator& other) const
+		{ return (ptr - other.ptr) / static_cast<std::ptrdiff_t>(Format::bytes); }
+
+	bool operator==(const PixelIterator& other) const { return ptr == other.ptr; }
+	bool operator!=(const PixelIterator& other) const { return ptr != other.ptr; }
+	bool operator<(const PixelIterator& other) const { return ptr < other.ptr; }
+};
+
+/// One row of pixels of format F.
+template<ImageFormat F, typename Byte = uint8_t>
+class PixelRow {
+public:
+	using Format = PixelFormat<F>;
+	using Iterator = PixelIterator<F, Byte>;
+
+	Byte* data;
+	unsigned int width;
+
+public:
+	Iterator begin() const { return {data}; }
+	Iterator end() const { return {data + width * Format::bytes}; }
+	unsigned int size() const { return width; }
+	PixelRef<F, Byte> operator[](unsigned int x) const { return {data + x * Format::bytes}; }
+};
+
+/// Typed view of the pixels of an image with the format F.
+/// Since the format and byte order are compile-time constants, accessing pixels
+/// through this is a lot cheaper than readPixel/writePixel, which have to
+/// check the format for every pixel.
+/// Example for filling an argb8888 image with red:
+/// ```
+/// ny::PixelView<ny::ImageFormat::argb8888> view(image);
+/// auto red = view.pack({255, 0, 0, 255});
+/// for(auto y = 0u; y < view.size()[1]; ++y)
+/// 	for(auto pixel : view.row(y))
+/// 		pixel.word(red);
+/// ```
+/// Byte is either uint8_t or const uint8_t for read-only access.
+template<ImageFormat F, typename Byte = uint8_t>
+class PixelView {
+public:
+	using Format = PixelFormat<F>;
+	using Row = PixelRow<F, Byte>;
+	using Reference = PixelRef<F, Byte>;
+
+public:
+	PixelView() = default;
+	PixelView(Byte* data, nytl::Vec2ui size, unsigned int byteStride = 0)
+		: data_(data), size_(size), stride_(byteStride ? byteStride : size[0] * Format::bytes) {}
+
+	/// Throws std::invalid_argument if the image does not have the format F or
+	/// its stride is no multiple of 8 bits.
+	template<typename P>
+	explicit PixelView(const BasicImage<P>& img) : data_(ny::data(img)), size_(img.size)
+	{
+		if(img.format != F) throw std::invalid_argument("ny::PixelView: invalid format");
+		if(bitStride(img) % 8) throw std::invalid_argument("ny::PixelView: invalid stride");
+		stride_ = bitStride(img) / 8;
+	}
+
+	Row row(unsigned int y) const { return {data_ + y * stride_, size_[0]}; }
+	Row operator[](unsigned int y) const { return row(y); }
+	Reference at(nytl::Vec2ui pos) const
+		{ return {data_ + pos[1] * stride_ + pos[0] * Format::bytes}; }
+
+	static constexpr uint32_t pack(nytl::Vec4u8 color) { return Format::pack(color); }
+	static nytl::Vec4u8 unpack(uint32_t word) { return Format::unpack(word); }
+
+	Byte* data() const { return data_; }
+	nytl::Vec2ui size() const { return size_; }
+	unsigned int stride() const { return stride_; } /// The stride in bytes
+
+protected:
+	Byte* data_ {};
+	nytl::Vec2ui size_ {};
+	unsigned int stride_ {};
+};
+
+template<ImageFormat F> using ConstPixelView = PixelView<F, const uint8_t>;
+
+} // namespace ny
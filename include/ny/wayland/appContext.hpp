@@ -26,6 +26,8 @@ public:
 	// - AppContext implementation -
 	bool dispatchEvents() override;
 	bool dispatchLoop(LoopControl& control) override;
+	nytl::Connection timer(std::chrono::nanoseconds duration, std::function<void()> func,
+		bool repeat = false) override;
 
 	MouseContext* mouseContext() override;
 	KeyboardContext* keyboardContext() override;
@@ -75,8 +77,13 @@ public:
 	wl_shell* wlShell() const;
 	xdg_shell* xdgShellV5() const;
 	zxdg_shell_v6* xdgShellV6() const;
+	wp_viewporter* wpViewporter() const;
 	wl_data_device_manager* wlDataManager() const;
 
+	/// Returns the pool all ShmBuffers are allocated from.
+	/// Creates it on the first call, throws if wl_shm is not available.
+	wayland::ShmPool& shmPool() const;
+
 	wl_cursor_theme* wlCursorTheme() const;
 	wl_pointer* wlPointer() const;
 	wl_keyboard* wlKeyboard() const;
@@ -84,6 +91,7 @@ public:
 	WaylandWindowContext* windowContext(wl_surface& surface) const;
 	const std::vector<wayland::Output>& outputs() const { return outputs_; }
 	bool shmFormatSupported(unsigned int wlShmFormat);
+	const std::vector<unsigned int>& shmFormats() const { return shmFormats_; }
 
 	EglSetup* eglSetup() const;
 	const char* appName() const { return "ny::app"; } // TODO: AppContextSettings
@@ -8,30 +8,86 @@
 #include <ny/wayland/windowContext.hpp>
 #include <ny/bufferSurface.hpp>
 
+#include <ny/wayland/util.hpp> // ny::wayland::ShmBuffer
+
 #include <nytl/vec.hpp>
+#include <nytl/span.hpp>
 #include <nytl/nonCopyable.hpp>
 
+#include <array>
 #include <vector>
 
 namespace ny {
 
 /// Wayland BufferSurface implementation.
-class WaylandBufferSurface : public nytl::NonCopyable, public BufferSurface {
+/// Uses a fixed number of shm buffers that are created when needed.
+/// The release events of the buffers are dispatched on an own event queue, so if all
+/// buffers are still used by the compositor, buffer() blocks until one is released
+/// without dispatching any other events.
+/// Tracks the age of the buffers and can copy the contents of the previous frame
+/// into a retrieved buffer (see BufferSurfaceSettings::preserveContents).
+/// Rendering at a reduced resolution is supported if the compositor implements
+/// wp_viewporter, the buffers are then scaled to the window size by the compositor.
+class WaylandBufferSurface : public nytl::NonMovable, public BufferSurface {
+public:
+	static constexpr auto minBufferCount = 2u;
+	static constexpr auto maxBufferCount = 4u;
+	static constexpr auto defaultBufferCount = 3u;
+
 public:
-	WaylandBufferSurface(WaylandWindowContext&);
+	/// The buffer count is clamped to [minBufferCount, maxBufferCount],
+	/// 0 uses defaultBufferCount.
+	/// The format is used if the compositor supports it, argb8888 otherwise.
+	WaylandBufferSurface(WaylandWindowContext&, const BufferSurfaceSettings& = {});
 	~WaylandBufferSurface();
 
 	BufferGuard buffer() override;
 	void apply(const BufferGuard&) noexcept override;
+	std::vector<ImageFormat> formats() const override;
+	bool renderScale(float scale) override;
+	float renderScale() const override { return scale_; }
+
+	/// Returns whether there is a buffer not used by the compositor, i.e.
+	/// whether buffer() would return without blocking.
+	/// Dispatches the release events that were already received.
+	bool available();
 
 	WaylandWindowContext& windowContext() const { return *windowContext_; }
-	const std::vector<wayland::ShmBuffer>& shmBuffers() const { return buffers_; }
+	nytl::Span<const wayland::ShmBuffer> shmBuffers() const { return {buffers_.data(), count_}; }
 	wayland::ShmBuffer* active() const { return active_; }
+	unsigned int bufferCount() const { return count_; }
+	bool preserveContents() const { return preserve_; }
+	wp_viewport* wpViewport() const { return viewport_; }
+
+protected:
+	/// Returns a buffer not used by the compositor or nullptr if there is none.
+	/// Prefers already created buffers.
+	wayland::ShmBuffer* unused();
+
+	/// Copies the regions changed since the given buffer was presented from the
+	/// last presented buffer. Returns the new age of the buffer.
+	unsigned int preserve(wayland::ShmBuffer& buffer, unsigned int age);
 
 protected:
 	WaylandWindowContext* windowContext_ {};
-	std::vector<wayland::ShmBuffer> buffers_;
+	std::array<wayland::ShmBuffer, maxBufferCount> buffers_;
+	unsigned int count_ {};
 	wayland::ShmBuffer* active_ {};
+	unsigned int format_ {}; // wl_shm format of the buffers
+	wl_event_queue* queue_ {}; // queue for the buffer release events
+
+	// render scale using wp_viewport
+	float scale_ {1.f};
+	wp_viewport* viewport_ {}; // created when first needed
+	nytl::Vec2ui destination_ {}; // the currently set destination size, 0 if unset
+	nytl::Vec2ui windowSize_ {}; // the window size of active_
+
+	// buffer age tracking
+	unsigned int frame_ {}; // number of presented frames
+	std::array<unsigned int, maxBufferCount> presented_ {}; // frame number, 0 if undefined
+	std::array<std::vector<nytl::Rect2ui>, maxBufferCount> damage_; // per frame, ring buffer
+	wayland::ShmBuffer* last_ {}; // the last presented buffer
+	bool preserve_ {};
 };
 
 /// WaylandWindowContext for a BufferSurface.
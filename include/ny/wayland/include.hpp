@@ -22,6 +22,9 @@ struct zxdg_shell_v6;
 struct zxdg_surface_v6;
 struct zxdg_toplevel_v6;
 
+struct wp_viewporter;
+struct wp_viewport;
+
 struct wl_display;
 struct wl_interface;
 struct wl_event_queue;
@@ -71,6 +74,7 @@ class WaylandDataOffer;
 
 namespace wayland {
 
+class ShmPool;
 class ShmBuffer;
 class ServerCallback;
 class Output;
@@ -11,23 +11,82 @@
 #include <nytl/vec.hpp>
 #include <nytl/callback.hpp>
 #include <nytl/functionTraits.hpp>
+#include <nytl/nonCopyable.hpp>
 
 #include <type_traits>
+#include <memory>
 #include <vector>
 #include <string>
+#include <cstddef>
 
 namespace ny {
 namespace wayland {
 
-// TODO: shmbuffer in preferred format, don't just always use argb
-// TODO: use one shared shm_pool for all ShmBuffers?
-// At least use pool of pools but not one for every buffer. This is really bad
+/// Shared memory pool from which all ShmBuffers of a WaylandAppContext are allocated.
+/// Backed by a single (memfd) file that is grown using wl_shm_pool_resize when
+/// needed. Allocated ranges are handed out first-fit and freed ranges are merged
+/// and reused, so creating or resizing buffers does not create new files or pools.
+/// The file is mapped into an address range reserved at creation, therefore
+/// the data pointer stays the same when the pool grows.
+class ShmPool : public nytl::NonMovable {
+public:
+	/// A range in the pool, offset and size in bytes.
+	struct Range {
+		unsigned int offset {};
+		unsigned int size {};
+	};
+
+	/// All allocations are aligned to this (in bytes).
+	static constexpr auto alignment = 64u;
+
+public:
+	/// Throws std::runtime_error if the pool cannot be created.
+	ShmPool(wl_shm& shm, unsigned int size = 1024 * 1024 * 4);
+	~ShmPool();
+
+	/// Allocates a range of at least the given size. Grows the pool if there
+	/// is no free range large enough.
+	/// Throws std::runtime_error if the pool cannot be grown.
+	Range allocate(unsigned int size);
+
+	/// Returns the given range (previously returned by allocate) to the pool.
+	void free(const Range& range);
+
+	/// Keeps a ShmBuffer that was destroyed while the compositor still used it.
+	/// Its range is only freed when the buffer is released, since until then the
+	/// compositor might still read from it. Used by ShmBuffer::destroy.
+	void keepUntilReleased(std::unique_ptr<ShmBuffer> buffer);
+
+	/// Destroys a buffer passed to keepUntilReleased. Used by ShmBuffer::released.
+	void released(const ShmBuffer& buffer);
+
+	wl_shm_pool& wlShmPool() const { return *pool_; }
+	uint8_t* data() const { return data_; }
+	unsigned int size() const { return size_; }
 
-/// Wraps and manages a wayland shm buffer.
+protected:
+	void grow(unsigned int size);
+
+protected:
+	int fd_ {-1};
+	wl_shm_pool* pool_ {};
+	uint8_t* data_ {};
+	unsigned int size_ {}; // current size of the file and the pool
+	std::size_t reserved_ {}; // size of the mapped address range
+	std::vector<Range> free_; // sorted by offset, never adjacent
+	std::vector<std::unique_ptr<ShmBuffer>> pending_; // destroyed but not yet released
+};
+
+/// Wraps and manages a wayland shm buffer allocated from the ShmPool
+/// of a WaylandAppContext.
 class ShmBuffer {
 public:
 	ShmBuffer() = default;
-	ShmBuffer(WaylandAppContext& ac, nytl::Vec2ui size, unsigned int stride = 0);
+
+	/// \param format The wl_shm format to use, argb8888 (0) by default.
+	/// Must be supported by the compositor.
+	ShmBuffer(WaylandAppContext& ac, nytl::Vec2ui size, unsigned int stride = 0,
+		unsigned int format = 0);
 	~ShmBuffer();
 
 	ShmBuffer(ShmBuffer&& other);
@@ -37,8 +96,14 @@ public:
 	unsigned int dataSize() const { return stride_ * size_[1]; }
 	unsigned int format() const { return format_; }
 	unsigned int stride() const { return stride_; }
-	uint8_t& data(){ return *data_; }
+	uint8_t& data(){ return pool_->data()[range_.offset]; }
 	wl_buffer& wlBuffer() const { return *buffer_; }
+	bool valid() const { return buffer_ != nullptr; }
+
+	/// Sets the event queue the release events of the buffer are dispatched on.
+	/// Will be used for all wl_buffers created for this ShmBuffer.
+	/// Passing nullptr uses the default queue.
+	void queue(wl_event_queue* queue);
 
 	/// Sets the internal used flag to true. Should be called everytime the buffer
 	/// is attached to a surface. The ShmBuffer will automatically clear the flag
@@ -51,30 +116,32 @@ public:
 	/// \sa use
 	bool used() const { return used_; }
 
-	/// Will trigger a buffer recreate if the given size exceeds the current size.
-	/// At the beginning 5MB will be allocated for a buffer
-	/// (e.g. more than 1000x1000px with 32bit color).
+	/// Changes the size of the buffer. The wl_buffer is recreated if the size changes,
+	/// a new range of the pool is only allocated if the given size exceeds the current one
+	/// or the buffer is still used by the compositor.
 	/// \return true if the data pointer changed, false if it stayed the same, i.e.
-	/// returns whether a new shm pool had to be created
+	/// returns whether a new range had to be allocated
 	bool size(nytl::Vec2ui size, unsigned int stride = 0);
 
 protected:
 	WaylandAppContext* appContext_ {};
+	ShmPool* pool_ {};
+	ShmPool::Range range_ {};
 
 	nytl::Vec2ui size_;
 	unsigned int stride_ {};
-	unsigned int shmSize_ = 1024 * 1024 * 5; // 5MB at the beginning
 
 	wl_buffer* buffer_ {};
-	wl_shm_pool* pool_ {};
-	uint8_t* data_ {};
-	unsigned int format_ {}; // wayland format; argb > bgra > rgba > abgr > xrgb (all 32 bits)
+	wl_event_queue* queue_ {};
+	unsigned int format_ {}; // wl_shm format
 	bool used_ {0}; // whether the compositor owns the buffer atm
+	bool pending_ {0}; // destroyed while used, owned by the pool until released
 
 protected:
 	void create(); // (re)creates the buffer for the set size/format/stride. Calls destroy
 	void destroy(); // frees all associated resources
-	void released(wl_buffer*) { used_ = false; } // registered as listener function
+	void createBuffer(); // creates the wl_buffer for the current range
+	void released(wl_buffer*); // registered as listener function
 };
 
 /// Holds information about a wayland output.
@@ -214,48 +281,6 @@ auto constexpr memberCallback = &detail::MemberCallback<std::decay_t<F>, f, S, L
 // template<auto f>
 // constexpr auto memberCallback = &detail::MemberCallback<std::decay_t<decltype(f)>, f>::call;
 
-// TODO: does not belong here... rather some common util file
-/// Utility template that allows a generic list of connectable objects.
-/// Used by WaylandAppContext for its fd listeners.
-template<typename T>
-class ConnectionList : public nytl::Connectable {
-public:
-	struct Value : public T {
-		using T::T;
-		nytl::ConnectionID clID_;
-	};
-
-	std::vector<Value> items;
-	nytl::ConnectionID highestID;
-
-public:
-	bool disconnect(const nytl::ConnectionID& id) override
-	{
-		for(auto it = items.begin(); it != items.end(); ++it) {
-			if(it->clID_ == id) {
-				items.erase(it);
-				return true;
-			}
-		}
-
-		return false;
-	}
-
-	nytl::Connection add(const T& value)
-	{
-		items.emplace_back();
-		static_cast<T&>(items.back()) = value;
-		items.back().clID_ = nextID();
-		return {*this, items.back().clID_};
-	}
-
-	nytl::ConnectionID nextID()
-	{
-		++reinterpret_cast<std::uintptr_t&>(highestID);
-		return highestID;
-	}
-};
-
 ///Used for e.g. move/resize requests where the serial of the trigger can be given
 ///All wayland event callbacks that retrieve a serial value should create a WaylandEventData
 ///object and pass it to the event handler.
@@ -10,6 +10,8 @@
 #include <ny/windowContext.hpp> // ny::WindowContexts
 #include <ny/windowSettings.hpp> // ny::WindowSettings
 #include <nytl/vec.hpp> // nytl::Vec
+#include <nytl/rect.hpp> // nytl::Rect
+#include <nytl/span.hpp> // nytl::Span
 
 namespace ny {
 
@@ -73,6 +75,7 @@ public:
 	wl_callback* frameCallback() const { return frameCallback_; }
 	WaylandSurfaceRole surfaceRole() const { return role_; }
 	nytl::Vec2ui size() const { return size_; }
+	bool opaque() const { return opaque_; }
 
 	//return nullptr if this object has another role
 	wl_shell_surface* wlShellSurface() const;
@@ -88,18 +91,29 @@ public:
 	nytl::Vec2i cursorHotspot() const { return cursorHotspot_; }
 	nytl::Vec2ui cursorSize() const { return cursorSize_; }
 
-	/// Attaches the given buffer, damages the surface and commits it.
+	/// Marks the buffer of a custom image cursor as used by the compositor.
+	/// Must be called everytime wlCursorBuffer is attached to a surface.
+	void useCursorBuffer();
+
+	/// Attaches the given buffer, damages the whole surface and commits it.
 	/// Does also add a frameCallback to the surface.
 	/// If called with a nullptr, no framecallback will be attached and the surface will
 	/// be unmapped. Note that if the WindowContext is currently hidden or not mapped,
 	/// no buffer will be attached.
 	void attachCommit(wl_buffer* buffer);
 
+	/// Like attachCommit but only damages the given rects (in buffer coordinates).
+	void attachCommit(wl_buffer* buffer, nytl::Span<const nytl::Rect2ui> damage);
+
 	WaylandAppContext& appContext() const { return *appContext_; }
 	wl_display& wlDisplay() const;
 
 protected:
 
+	/// Sets the whole surface as opaque region if the window is opaque.
+	/// Must be called when the size changes, applied with the next commit.
+	void updateOpaqueRegion();
+
 	/// Tries to reparse the current state from the array of xdg states.
 	/// Will send a StateEvent if it changed
 	void reparseState(const wl_array& states);
@@ -132,6 +146,7 @@ protected:
 	WaylandAppContext* appContext_ {};
 	wl_surface* wlSurface_ {};
 	nytl::Vec2ui size_ {};
+	bool opaque_ {}; // whether the contents are always opaque, see WindowSettings::opaque
 
 	// if this is == nullptr, the window is ready to be redrawn.
 	// otherwise waiting for the callback to be called
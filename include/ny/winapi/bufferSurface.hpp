@@ -18,6 +18,7 @@ public:
 	~WinapiBufferSurface();
 
 	BufferGuard buffer() override;
+	std::vector<ImageFormat> formats() const override { return {ImageFormat::argb8888}; }
 	void apply(const BufferGuard&) noexcept override;
 
 	WinapiWindowContext& windowContext() const { return *windowContext_; }
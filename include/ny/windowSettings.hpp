@@ -8,6 +8,7 @@
 #include <ny/cursor.hpp> // ny::Cursor
 #include <ny/nativeHandle.hpp> // ny::NativeHandle
 #include <ny/surface.hpp> // ny::SurfaceType
+#include <ny/image.hpp> // ny::ImageFormat
 
 #include <nytl/flags.hpp> // NYTL_FLAG_OPS
 #include <nytl/vec.hpp> // nytl::Vec
@@ -108,6 +109,29 @@ struct BufferSurfaceSettings {
 	///object (see surface.hpp).
 	///Can be nullptr.
 	BufferSurface** storeSurface {};
+
+	/// The maximum number of buffers the BufferSurface may use, i.e. how many
+	/// frames can be queued up. 0 uses the backends default.
+	/// Currently only used on wayland (clamped to 2-4 buffers there).
+	unsigned int bufferCount {};
+
+	/// Whether the contents of the previous frame should be copied into every
+	/// retrieved buffer, so that only the changed regions have to be redrawn.
+	/// Only the damaged regions of the frames the buffer missed are copied.
+	/// Currently only used on wayland.
+	/// \sa BufferGuard::age
+	bool preserveContents {};
+
+	/// The format the buffers should preferably have. Only used if the surface
+	/// supports it natively, the format actually used is the first one returned by
+	/// BufferSurface::formats. ImageFormat::none lets the backend choose.
+	/// \sa ConvertingBufferSurface
+	ImageFormat format {};
+
+	/// The initial render scale, i.e. the size of the buffers relative to the window.
+	/// Ignored (with a warning) if the backend does not support scaling.
+	/// \sa BufferSurface::renderScale
+	float scale {1.f};
 };
 
 /// Used as magical signal value for no specific postion.
@@ -147,6 +171,11 @@ public:
 	Cursor cursor {}; ///< Default cursor for the whole window
 	WindowListener* listener {}; ///< first listener after initialization. Can be changed
 	bool transparent = false; ///< Whether to try to make the window possibly transparent
+
+	/// Promises that the window contents are always fully opaque, i.e. that alpha can
+	/// be ignored. Allows backends to choose formats without alpha and to tell the
+	/// compositor that no blending is needed. Takes precedence over transparent.
+	bool opaque = false;
 	bool droppable = false; ///< Whether the window can handle drop events
 
 	/// Can be used to specify if and which context should be created for the window.
@@ -5,14 +5,30 @@
 #pragma once
 #include <ny/x11/include.hpp>
 #include <ny/appContext.hpp>
+#include <nytl/connection.hpp> // nytl::Connection
 
 #include <map>
 #include <memory>
+#include <vector>
+#include <functional> // std::function
 
 namespace ny {
 
-///X11 AppContext implementation.
+/// X11 AppContext implementation.
+/// The dispatch loop polls the xcb connection fd together with an eventfd that is
+/// used to wake it up (LoopControl) and any custom fds registered with fdCallback.
+/// Events are processed in batches of all events that are available without
+/// blocking, the connection is only flushed once per batch.
 class X11AppContext : public AppContext {
+public:
+	/// Statistics about the processed event batches.
+	struct DispatchStats {
+		unsigned long batches {}; // number of processed (non-empty) batches
+		unsigned long events {}; // total number of processed events
+		unsigned int lastBatch {}; // the number of events in the last batch
+		unsigned int maxBatch {}; // the number of events in the largest batch
+	};
+
 public:
 	X11AppContext();
 	~X11AppContext();
@@ -24,6 +40,8 @@ public:
 
 	bool dispatchEvents() override;
 	bool dispatchLoop(LoopControl& control) override;
+	nytl::Connection timer(std::chrono::nanoseconds duration, std::function<void()> func,
+		bool repeat = false) override;
 
 	bool clipboard(std::unique_ptr<DataSource>&& dataSource) override;
 	DataOffer* clipboard() override;
@@ -37,6 +55,17 @@ public:
 	X11WindowContext* windowContext(xcb_window_t);
 	bool checkErrorWarn();
 
+	/// Returns statistics about the event batches processed so far.
+	const DispatchStats& dispatchStats() const { return dispatchStats_; }
+
+	/// Can be called to register custom listeners for fds that the dispatch loop will
+	/// then poll for.
+	using FdCallbackFunc = std::function<void(int fd, unsigned int events)>;
+	using FdCallbackFuncConn = std::function<void(nytl::Connection, int fd, unsigned int events)>;
+
+	nytl::Connection fdCallback(int fd, unsigned int events, const FdCallbackFunc& func);
+	nytl::Connection fdCallback(int fd, unsigned int events, const FdCallbackFuncConn& func);
+
 	Display& xDisplay() const { return *xDisplay_; }
 	xcb_connection_t& xConnection() const { return *xConnection_; }
 	x11::EwmhConnection& ewmhConnection() const;
@@ -55,10 +84,23 @@ public:
 	xcb_atom_t atom(const std::string& name);
 	const x11::Atoms& atoms() const;
 
+protected:
+	/// Polls for all registered fd callbacks as well as for the xcb connection fd
+	/// with the given events if they are not 0. Uses the given timeout for poll calls.
+	/// Returns the value poll returned.
+	/// Will not stop on a signal.
+	int pollFds(short xEvents, int timeout);
+
+	/// Reads all available events (without blocking) and processes them.
+	/// Flushes the connection once afterwards if any event was processed.
+	/// Returns the number of processed events.
+	unsigned int dispatchBatch();
+
 protected:
 	Display* xDisplay_  = nullptr;
 	xcb_connection_t* xConnection_ = nullptr;
 	xcb_window_t xDummyWindow_ = {};
+	int eventfd_ = -1; // used to wake up the dispatch loop
 
 	int xDefaultScreenNumber_ = 0;
 	xcb_screen_t* xDefaultScreen_ = nullptr;
@@ -69,6 +111,8 @@ protected:
 	std::unique_ptr<X11MouseContext> mouseContext_;
 	std::unique_ptr<X11KeyboardContext> keyboardContext_;
 
+	DispatchStats dispatchStats_ {};
+
 	struct Impl;
 	std::unique_ptr<Impl> impl_;
 };
@@ -12,18 +12,42 @@
 #include <nytl/nonCopyable.hpp>
 
 #include <memory>
+#include <vector>
 
 struct xcb_image_t;
+struct xcb_special_event;
 
 namespace ny {
 
 /// X11 BufferSurface implementation.
+/// If the server supports the Present extension and shared memory pixmaps, the
+/// contents are drawn into a small ring of shm pixmaps that are presented (synced
+/// to vblank) and only reused when the server signals that they are idle.
+/// Otherwise the buffer is copied onto the window using (shm) put image requests.
+/// Shared memory segments are created with memfd if the server supports
+/// MIT-SHM 1.2 and as SysV shared memory otherwise.
+/// Rendering at a reduced resolution is supported if the server has the RENDER
+/// extension (0.6 or later). The buffer is then put onto an offscreen pixmap and
+/// composited onto the window with a scaling transform (bilinear filter) instead
+/// of presenting it.
 class X11BufferSurface : public nytl::NonMovable, public BufferSurface {
 public:
-	X11BufferSurface(X11WindowContext&);
+	/// The maximum number of pixmaps used when presenting.
+	static constexpr auto maxPresentBuffers = 3u;
+
+	/// The number of shm segments used for put image requests.
+	static constexpr auto maxShmBuffers = 2u;
+
+public:
+	X11BufferSurface(X11WindowContext&, const BufferSurfaceSettings& = {});
 	~X11BufferSurface();
 
 	BufferGuard buffer() override;
+	bool renderScale(float scale) override;
+	float renderScale() const override { return scale_; }
+
+	/// The format is determined by the visual of the window, so it is the only one.
+	std::vector<ImageFormat> formats() const override { return {format_}; }
 
 	X11WindowContext& windowContext() const { return *windowContext_; }
 	xcb_connection_t& xConnection() const { return windowContext().xConnection(); }
@@ -31,28 +55,120 @@ public:
 	bool shm() const { return shm_; }
 	bool active() const { return active_; }
 
+	/// Returns whether shm segments are passed to the server as file descriptors.
+	bool shmFd() const { return shmFd_; }
+
+	/// Returns whether pixmaps are presented using the Present extension.
+	bool present() const { return present_; }
+
+	/// Returns whether there is a presented frame that was not completed yet.
+	bool framePending() const { return framePending_; }
+
+	/// Should be called when a present complete notify event for the window
+	/// is received. Returns whether the last presented frame was completed.
+	bool completed(uint32_t serial);
+
+	/// Should be called when a shm completion event for the window is received.
+	/// The buffer that was put from the given segment can be used again.
+	void shmCompleted(uint32_t shmseg);
+
+protected:
+	/// A shared memory segment attached to the server.
+	struct ShmSegment {
+		uint32_t seg {};
+		uint8_t* data {};
+		unsigned int size {};
+		int shmid {-1}; // only for SysV segments, already removed after attaching
+	};
+
+	/// A shm buffer that can be drawn into.
+	/// Buffers for presenting additionally have a pixmap of the segment.
+	struct Buffer {
+		ShmSegment shm {};
+		uint32_t pixmap {};
+		nytl::Vec2ui size {};
+		bool busy {}; // presented or put and not yet released by the server
+		bool presented {}; // busy until the idle event arrives
+	};
+
 protected:
 	void apply(const BufferGuard&) noexcept override;
-	void resize(nytl::Vec2ui size);
+
+	/// Puts the given rect of the active buffer onto the window.
+	/// \param last Whether this is the last put for the active buffer, requests
+	/// a completion event for shm puts.
+	void put(const Image& img, const nytl::Rect2ui& rect, bool last) noexcept;
+
+	/// Checks whether presenting can be used and if so initializes it.
+	void initPresent();
+
+	/// Checks whether the render extension can be used for scaling and if so
+	/// creates a picture for the window. Returns whether scaling is supported.
+	bool initRender();
+
+	/// Composites the given damage of the scale pixmap onto the window.
+	void compositeScaled(const BufferGuard&) noexcept;
+
+	/// Returns an unused shm buffer for the given size (in bytes).
+	/// Blocks if all buffers are busy.
+	Buffer& shmBuffer(nytl::Vec2ui size, unsigned int byteSize);
+
+	/// Presents the active buffer with the damage from the given guard.
+	void presentActive(const BufferGuard&) noexcept;
+
+	/// Handles the idle events that were received so far.
+	/// If wait is true, blocks until at least one was received.
+	void processIdleEvents(bool wait);
+
+	/// Waits until the server has processed all put requests.
+	void waitPuts();
+
+	ShmSegment createSegment(unsigned int size);
+	void destroy(ShmSegment&);
+	void destroy(Buffer&);
 
 protected:
 	X11WindowContext* windowContext_ {};
 
 	ImageFormat format_ {};
+	unsigned int scanlinePad_ {8}; // the required row alignment in bits
 	uint32_t gc_ {};
 	bool shm_ {};
+	bool shmFd_ {};
 
 	bool active_ {};
 	nytl::Vec2ui size_; // size of active
-	unsigned int byteSize_ {}; // the size in bytes of ((shm_) ? shmaddr_ : data_)
-	uint8_t* data_ {}; // the actual data (either shmaddr or points so ownedBuffer)
 
- 	// when using shm
-	unsigned int shmid_ {};
-	uint32_t shmseg_ {};
+	// the shm buffers, present pixmaps or segments for put image
+	std::vector<Buffer> buffers_;
+	Buffer* activeBuffer_ {};
 
 	// otherwise when using owned buffer because shm not available
 	std::unique_ptr<uint8_t[]> ownedBuffer_;
+	unsigned int byteSize_ {}; // the size in bytes of ownedBuffer_
+	unsigned int maxRequestBytes_ {}; // the maximum size of a put_image request
+	std::vector<uint8_t> packed_; // damage rects are copied into this for put_image
+
+	// when using present
+	bool present_ {};
+	bool xfixes_ {}; // whether damage can be passed as update region
+	bool framePending_ {};
+	uint32_t serial_ {}; // serial of the last presented pixmap
+	uint32_t idleEventID_ {};
+	uint32_t completeEventID_ {};
+	xcb_special_event* idleEvents_ {}; // own queue for idle events
+
+	// when rendering at a different scale
+	float scale_ {1.f};
+	bool renderChecked_ {}; // whether initRender was already called
+	bool render_ {}; // whether the render extension can be used
+	bool scaled_ {}; // whether the active buffer is scaled
+	nytl::Vec2ui windowSize_ {}; // window size for the active buffer
+	uint32_t pictFormat_ {}; // render picture format of the window visual
+	uint32_t windowPicture_ {};
+	uint32_t scalePixmap_ {}; // has the size of the scaled buffers
+	uint32_t scalePicture_ {};
+	nytl::Vec2ui scaleSize_ {}; // size of scalePixmap_
 };
 
 /// X11 WindowContext implementation with a drawable buffer surface.
@@ -62,9 +178,13 @@ public:
 	~X11BufferWindowContext() = default;
 
 	Surface surface() override;
+	void refresh() override;
+	void presentCompleteEvent(uint32_t serial) override;
+	void shmCompletionEvent(uint32_t shmseg) override;
 
 protected:
 	X11BufferSurface bufferSurface_;
+	bool refreshFlag_ {}; // whether to redraw when the pending frame completes
 };
 
 } // namespace ny
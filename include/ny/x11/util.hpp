@@ -170,5 +170,19 @@ ImageFormat visualToFormat(const xcb_visualtype_t& visual, unsigned int depth);
 /// Returns zero for unknown/invalid visuals.
 unsigned int visualDepth(xcb_screen_t& screen, unsigned int visualID);
 
+/// Returns statistics about the synchronous requests made so far, i.e. the number
+/// of requests whose reply or error ny waited for (a full round trip to the x server).
+/// Counts checked requests (X11ErrorCategory::check*), geometry queries and syncs.
+/// Only meant for debugging, e.g. to assert that drawing a frame does not need
+/// any round trips by comparing the value before and after drawing.
+unsigned int syncRequestCount();
+
+namespace detail {
+
+/// Increments the syncRequestCount statistic. Only used by the backend itself.
+void countSyncRequest();
+
+} // namespace detail
+
 } // namespace x11
 } // namespace ny
@@ -7,6 +7,7 @@
 #include <ny/x11/include.hpp>
 #include <ny/windowContext.hpp>
 #include <ny/windowSettings.hpp>
+#include <nytl/vec.hpp>
 
 #include <vector>
 
@@ -59,6 +60,17 @@ public:
 	// specific event handlers
 	virtual void reparentEvent();
 
+	/// Called by the AppContext when the window was configured, updates the cached size.
+	virtual void configureEvent(nytl::Vec2ui size);
+
+	/// Called by the AppContext when a pixmap presented with the Present extension
+	/// on this window was completed.
+	virtual void presentCompleteEvent(uint32_t) {}
+
+	/// Called by the AppContext when a shm put image request with the given
+	/// segment on this window was completed.
+	virtual void shmCompletionEvent(uint32_t) {}
+
 	X11AppContext& appContext() const { return *appContext_; } /// The associated AppContext
 	uint32_t xWindow() const { return xWindow_; } /// The underlaying x window handle
 
@@ -66,7 +78,14 @@ public:
 	x11::EwmhConnection& ewmhConnection() const; /// The associated ewmh connection (helper)
 	const X11ErrorCategory& errorCategory() const; /// Shortcut for the AppContexts ErrorCategory
 
-	nytl::Vec2ui size() const; /// Queries the current window size
+	/// Returns the current window size without asking the x server.
+	/// It is cached from the last configure event or resize request.
+	nytl::Vec2ui size() const { return size_; }
+
+	/// Queries the current window size from the x server and updates the cached size.
+	/// Needs a round trip, so size() should be preferred.
+	nytl::Vec2ui querySize();
+
 	void overrideRedirect(bool redirect); /// Sets the overrideRedirect flag for the window
 	void transientFor(uint32_t win); /// Makes the window transient for another x window
 
@@ -162,6 +181,9 @@ protected:
 	unsigned int visualID_ {};
 	unsigned int depth_ {};
 
+	// the window size as known from the last configure event or resize request
+	nytl::Vec2ui size_ {};
+
 	// Stored EWMH states can be used to check whether it is fullscreen, maximized etc.
 	std::vector<uint32_t> states_;
 	bool customDecorated_ {};
@@ -10,11 +10,9 @@
 #include <ny/log.hpp> // ny::log
 #include <ny/key.hpp> // ny::Keycode
 #include <ny/mouseButton.hpp> // ny::MouseButton
-#include <ny/image.hpp> // ny::Image
+#include <ny/image.hpp> // ny::Image, ny::fill
 #include <ny/event.hpp> // ny::*Event
 
-#include <cstring> // std::memset
-
 // The second ny example that shows some further basic functionality
 // The example window has the following shortcuts (keycodes):
 // 	- d: try to toggle server decorations
@@ -85,8 +83,7 @@ void MyWindowListener::draw(const ny::DrawEvent&)
 
 	auto guard = bufferSurface->buffer();
 	auto image = guard.get();
-	auto size = ny::dataSize(image);
-	std::memset(image.data, 0xFF, size); // opaque white
+	ny::fill(image, {255, 255, 255, 255}); // opaque white
 }
 
 void MyWindowListener::key(const ny::KeyEvent& keyEvent)
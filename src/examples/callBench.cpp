@@ -0,0 +1,66 @@
+#include <ny/backend.hpp> // ny::Backend
+#include <ny/appContext.hpp> // ny::AppContext
+#include <ny/loopControl.hpp> // ny::LoopControl
+#include <ny/log.hpp> // ny::log
+
+#include <atomic> // std::atomic
+#include <chrono> // std::chrono
+#include <thread> // std::thread
+#include <vector> // std::vector
+
+// Benchmark for LoopControl::call.
+// For 1 to 16 producer threads, every thread queues callsPerThread small
+// functions into the dispatch loop of the AppContext as fast as it can.
+// Outputs how many calls per second were executed on the ui thread, measured
+// from entering the dispatch loop until the last function was called.
+// No window is created, so this only measures the cross-thread call path of
+// the chosen backend.
+
+constexpr auto callsPerThread = 200000u;
+
+double run(ny::AppContext& ac, unsigned int threadCount)
+{
+	ny::LoopControl control;
+	std::atomic<bool> start {false};
+	std::vector<std::thread> threads;
+
+	// only accessed from the ui thread
+	auto total = threadCount * callsPerThread;
+	auto called = 0u;
+
+	for(auto i = 0u; i < threadCount; ++i) {
+		threads.emplace_back([&]{
+			while(!start.load()) std::this_thread::yield();
+			for(auto c = 0u; c < callsPerThread; ++c) {
+				control.call([&]{
+					if(++called == total) control.stop();
+				});
+			}
+		});
+	}
+
+	// the producers start once the loop is running. Calls are dropped until
+	// the loop has set up the LoopControl, so retry from another thread.
+	threads.emplace_back([&]{
+		while(!control.call([&]{ start.store(true); })) std::this_thread::yield();
+	});
+
+	auto begin = std::chrono::steady_clock::now();
+	ac.dispatchLoop(control);
+	auto end = std::chrono::steady_clock::now();
+
+	for(auto& thread : threads) thread.join();
+	return total / std::chrono::duration<double>(end - begin).count();
+}
+
+int main()
+{
+	auto& backend = ny::Backend::choose();
+	auto ac = backend.createAppContext();
+
+	dlg_info("{} calls per producer thread", callsPerThread);
+	for(auto threads : {1u, 2u, 4u, 8u, 16u}) {
+		auto rate = run(*ac, threads);
+		dlg_info("{} producer threads: {} calls/sec", threads, static_cast<unsigned long>(rate));
+	}
+}
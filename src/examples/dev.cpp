@@ -98,8 +98,7 @@ public:
 
 		auto bufferGuard = surface->buffer();
 		auto buffer = bufferGuard.get();
-		auto size = dataSize(buffer);
-		std::memset(buffer.data, 0xFF, size);
+		ny::fill(buffer, {255, 255, 255, 255});
 	}
 
 	void mouseButton(const ny::MouseButtonEvent& ev) override
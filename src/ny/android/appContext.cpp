@@ -53,7 +53,7 @@ class AndroidLoopImpl : public ny::LoopInterface {
 public:
 	ALooper& looper;
 	std::atomic<bool> run {true};
-	std::queue<std::function<void()>> functions {};
+	std::queue<LoopFunction> functions {};
 	std::mutex mutex {};
 
 public:
@@ -62,6 +62,8 @@ public:
 	{
 	}
 
+	~AndroidLoopImpl() { detach(); }
+
 	bool stop() override
 	{
 		run.store(false);
@@ -69,7 +71,7 @@ public:
 		return true;
 	}
 
-	bool call(std::function<void()> function) override
+	bool call(LoopFunction&& function) override
 	{
 		if(!function) return false;
 
@@ -87,7 +89,7 @@ public:
 		ALooper_wake(&looper);
 	}
 
-	std::function<void()> popFunction()
+	LoopFunction popFunction()
 	{
 		std::lock_guard<std::mutex> lock(mutex);
 		if(functions.empty()) return {};
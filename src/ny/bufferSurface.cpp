@@ -0,0 +1,111 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <ny/bufferSurface.hpp>
+#include <ny/log.hpp>
+
+#include <stdexcept> // std::logic_error
+
+namespace ny {
+namespace {
+
+// Clips the given rect to the given size. Returns false if nothing is left.
+bool clip(nytl::Rect2ui& rect, nytl::Vec2ui size)
+{
+	if(rect.position[0] >= size[0] || rect.position[1] >= size[1]) return false;
+	rect.size[0] = std::min(rect.size[0], size[0] - rect.position[0]);
+	rect.size[1] = std::min(rect.size[1], size[1] - rect.position[1]);
+	return rect.size[0] && rect.size[1];
+}
+
+} // anonymous util namespace
+
+// BufferSurface
+bool BufferSurface::renderScale(float scale)
+{
+	if(!(scale > 0.f)) throw std::invalid_argument("ny::BufferSurface::renderScale: invalid scale");
+	return scale == 1.f;
+}
+
+// ConvertingBufferSurface
+ConvertingBufferSurface::ConvertingBufferSurface(BufferSurface& surface, ImageFormat format)
+	: surface_(&surface), format_(format)
+{
+	if(format == ImageFormat::none)
+		throw std::invalid_argument("ny::ConvertingBufferSurface: invalid format");
+
+	// only the first format is the one that buffer() actually uses
+	auto formats = surface.formats();
+	converting_ = formats.empty() || formats.front() != format;
+}
+
+BufferGuard ConvertingBufferSurface::buffer()
+{
+	if(!converting_) return surface_->buffer();
+	if(guard_)
+		throw std::logic_error("ny::ConvertingBufferSurface: there is already an active guard");
+
+	// constructed in place since applying is bound to the guards lifetime
+	guard_.reset(new BufferGuard(surface_->buffer()));
+
+	// the contents of our buffer are preserved as long as the size stays the same
+	auto size = guard_->get().size;
+	auto age = 1u;
+	if(buffer_.size != size) {
+		auto stride = size[0] * bitSize(format_);
+		buffer_.data = std::make_unique<std::uint8_t[]>((stride * size[1] + 7) / 8);
+		buffer_.size = size;
+		buffer_.format = format_;
+		buffer_.stride = stride;
+		age = 0u;
+	}
+
+	return {*this, buffer_, age, guard_->windowSize()};
+}
+
+void ConvertingBufferSurface::apply(const BufferGuard& guard) noexcept
+{
+	if(!guard_ || guard.get().data != buffer_.data.get()) {
+		ny_warn("::ConvertingBufferSurface::apply"_src, "invalid BufferGuard given");
+		return;
+	}
+
+	auto& target = guard_->get();
+	auto fullRect = nytl::Rect2ui {{0u, 0u}, buffer_.size};
+	auto& damage = damage_[++frame_ % damageHistory];
+	if(guard.fullDamage()) damage = {fullRect};
+	else damage = guard.damage();
+
+	// the wrapped buffer is missing the changes of its last (age - 1) frames
+	// and the damage of this frame. Convert everything if they are not known
+	std::vector<nytl::Rect2ui> convert;
+	auto age = guard_->age();
+	if(!age || age > damageHistory) {
+		convert = {fullRect};
+	} else {
+		for(auto f = frame_ - (age - 1); f <= frame_; ++f) {
+			auto& frameDamage = damage_[f % damageHistory];
+			convert.insert(convert.end(), frameDamage.begin(), frameDamage.end());
+		}
+	}
+
+	try {
+		for(auto rect : convert) {
+			if(!clip(rect, buffer_.size)) continue;
+			blit(subImage(buffer_, rect), target, rect.position);
+		}
+	} catch(const std::exception& err) {
+		ny_warn("::ConvertingBufferSurface::apply"_src, "converting failed: {}", err.what());
+	}
+
+	// only this frames damage has to be passed along
+	if(!guard.fullDamage()) {
+		for(auto& rect : guard.damage()) guard_->damage(rect);
+		if(guard.damage().empty()) guard_->damage({});
+	}
+
+	guard_.reset();
+}
+
+} // namespace ny
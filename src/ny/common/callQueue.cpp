@@ -0,0 +1,112 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <ny/common/callQueue.hpp>
+#include <cstdint> // std::intptr_t
+
+// The ring is a bounded queue as described by Dmitry Vyukov
+// (http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue)
+// with a single consumer. Every cell has a sequence number that tells producers
+// and the consumer whether the cell is free or filled for the current round.
+//
+// Wakeups are coalesced using signaled_: producers only have to wake the consumer
+// if they are the first ones to set it. The consumer resets it before taking
+// functions out of the queue, so every function pushed after that will either
+// be taken out in the same run or trigger another wakeup.
+
+namespace ny {
+
+CallQueue::CallQueue() : cells_(std::make_unique<Cell[]>(capacity))
+{
+	static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+	for(auto i = 0u; i < capacity; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+CallQueue::~CallQueue() = default;
+
+bool CallQueue::push(LoopFunction&& func)
+{
+	// once something was pushed into overflow_, all following functions have to
+	// go there as well until the consumer took them, otherwise their order might change
+	if(overflowing_.load(std::memory_order_acquire) || !tryPush(func)) {
+		std::lock_guard<std::mutex> lock(overflowMutex_);
+		overflow_.push_back(std::move(func));
+		overflowing_.store(true, std::memory_order_release);
+	}
+
+	return !signaled_.exchange(true, std::memory_order_acq_rel);
+}
+
+unsigned int CallQueue::run()
+{
+	// synchronizes with the producers that set it, makes their functions visible
+	signaled_.exchange(false, std::memory_order_acq_rel);
+
+	auto count = 0u;
+	LoopFunction func;
+	while(true) {
+		// continue a batch that was interrupted by an exception
+		while(batchPos_ < batch_.size()) {
+			auto current = std::move(batch_[batchPos_++]);
+			++count;
+			current();
+		}
+
+		while(tryPop(func)) {
+			++count;
+			func();
+		}
+
+		// a producer has not finished writing its function yet, the overflow functions
+		// must wait for it. It will wake us up again when it has finished
+		if(head_ != tail_.load(std::memory_order_acquire)) break;
+		if(!overflowing_.load(std::memory_order_acquire)) break;
+
+		batch_.clear();
+		batchPos_ = 0u;
+		{
+			std::lock_guard<std::mutex> lock(overflowMutex_);
+			std::swap(batch_, overflow_);
+			overflowing_.store(false, std::memory_order_release);
+		}
+	}
+
+	return count;
+}
+
+bool CallQueue::tryPush(LoopFunction& func)
+{
+	auto pos = tail_.load(std::memory_order_relaxed);
+	Cell* cell;
+	while(true) {
+		cell = &cells_[pos & (capacity - 1)];
+		auto seq = cell->sequence.load(std::memory_order_acquire);
+		auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+		if(diff == 0) {
+			if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+		} else if(diff < 0) {
+			return false; // full
+		} else {
+			pos = tail_.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->func = std::move(func);
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool CallQueue::tryPop(LoopFunction& func)
+{
+	auto& cell = cells_[head_ & (capacity - 1)];
+	auto seq = cell.sequence.load(std::memory_order_acquire);
+	if(seq != head_ + 1) return false; // empty or not yet written
+
+	func = std::move(cell.func);
+	cell.sequence.store(head_ + capacity, std::memory_order_release);
+	++head_;
+	return true;
+}
+
+} // namespace ny
@@ -0,0 +1,114 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <ny/common/timer.hpp>
+#include <nytl/scope.hpp>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min_element
+#include <system_error> // std::system_error
+#include <stdexcept> // std::invalid_argument
+#include <cerrno> // errno
+#include <cstdint> // std::uintptr_t
+
+namespace ny {
+
+TimerQueue::TimerQueue()
+{
+	// steady_clock uses CLOCK_MONOTONIC as well, but the timerfd is only ever
+	// armed with relative durations anyways
+	fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(fd_ == -1)
+		throw std::system_error(errno, std::generic_category(), "ny::TimerQueue: timerfd_create");
+}
+
+TimerQueue::~TimerQueue()
+{
+	if(fd_ != -1) close(fd_);
+}
+
+nytl::Connection TimerQueue::add(std::chrono::nanoseconds duration,
+	std::function<void()> func, bool repeat)
+{
+	if(duration.count() < 0 || (repeat && duration.count() == 0))
+		throw std::invalid_argument("ny::TimerQueue::add: invalid duration");
+
+	++reinterpret_cast<std::uintptr_t&>(highestID_);
+	auto interval = repeat ? duration : std::chrono::nanoseconds {};
+	timers_.push_back({Clock::now() + duration, interval, std::move(func), highestID_});
+	arm();
+
+	return {*this, highestID_};
+}
+
+bool TimerQueue::disconnect(const nytl::ConnectionID& id)
+{
+	auto it = std::find_if(timers_.begin(), timers_.end(),
+		[&](auto& timer) { return timer.id == id; });
+	if(it == timers_.end()) return false;
+
+	timers_.erase(it);
+	arm();
+	return true;
+}
+
+void TimerQueue::dispatch()
+{
+	// reset the readable state, the number of expirations is not needed
+	std::uint64_t expirations;
+	read(fd_, &expirations, sizeof(expirations));
+
+	// the callbacks may add or disconnect timers, so remember the ids of the
+	// due timers first and look every one of them up again before calling it
+	// the timerfd has to be rearmed even if a callback throws
+	auto armGuard = nytl::makeScopeGuard([&]{ arm(); });
+	auto now = Clock::now();
+	std::vector<nytl::ConnectionID> due;
+	for(auto& timer : timers_)
+		if(timer.deadline <= now + coalesceWindow) due.push_back(timer.id);
+
+	for(auto id : due) {
+		auto it = std::find_if(timers_.begin(), timers_.end(),
+			[&](auto& timer) { return timer.id == id; });
+		if(it == timers_.end()) continue;
+
+		// repeating timers skip the periods that were missed completely
+		// one-shot timers are removed before they are called
+		std::function<void()> func;
+		if(it->interval.count()) {
+			auto missed = (now - it->deadline) / it->interval;
+			it->deadline += (std::max<decltype(missed)>(missed, 0) + 1) * it->interval;
+			func = it->func;
+		} else {
+			func = std::move(it->func);
+			timers_.erase(it);
+		}
+
+		func();
+	}
+}
+
+void TimerQueue::arm()
+{
+	itimerspec spec {};
+	auto earliest = std::min_element(timers_.begin(), timers_.end(),
+		[](auto& a, auto& b) { return a.deadline < b.deadline; });
+
+	// a zero value disarms the timer, so already expired deadlines use 1ns
+	if(earliest != timers_.end()) {
+		auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			earliest->deadline - Clock::now());
+		left = std::max(left, std::chrono::nanoseconds(1));
+
+		auto seconds = std::chrono::duration_cast<std::chrono::seconds>(left);
+		spec.it_value.tv_sec = seconds.count();
+		spec.it_value.tv_nsec = (left - seconds).count();
+	}
+
+	timerfd_settime(fd_, 0, &spec, nullptr);
+}
+
+} // namespace ny
@@ -3,153 +3,1548 @@
 // See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
 
 #include <ny/image.hpp>
+#include <ny/pixelView.hpp>
+#include <nytl/nonCopyable.hpp> // nytl::NonMovable
 
 #include <array> // std::array
 #include <cmath> // std::ceil
+#include <cstring> // std::memcpy
+#include <cstdint> // std::uintptr_t
+#include <utility> // std::index_sequence
+#include <algorithm> // std::min
+#include <vector> // std::vector
+#include <thread> // std::thread
+#include <mutex> // std::mutex
+#include <condition_variable> // std::condition_variable
+#include <atomic> // std::atomic
+#include <stdexcept> // std::out_of_range
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define NY_IMAGE_X86
+	#include <immintrin.h>
+#endif
 
 // NOTE on implementation:
-// Due to the wanted simplicity of ny/image most of the functions here
-// are implemented with hardcoded format switches.
-// Most functions must be changed when additional formats are introduced.
-// There exist a (rather complex) ny/image implementation (removed 02.05.2017) that
-// implements the functions only by a meta-description of formats, which was removed
-// due to being over-designed for the needs of ny, rather error-prone and not well tested.
-//
-// Functions to be changed when adding a new format include
-// - toggleWordOrder
-// - {bit,byte}Size
-// - {read/write}Pixel (only the bitOffset versions)
-//   - may need huge changed for not bit or byte aligned formats
-// - norm
+// All formats are described by a single table (formatInfos in ny/image.hpp), that
+// stores the size of a pixel and the position and size of every channel in the
+// pixel word. Everything here is derived from that description, so adding
+// a new format means adding a new ImageFormat value and its FormatInfo.
+// Formats must either be byte aligned (at most 32 bits) or have a bit size that
+// divides 8, so that a pixel never spans multiple bytes.
+// For byte aligned formats, {read,write}Pixel dispatch into the compile-time
+// PixelFormat of ny/pixelView.hpp, which is also what user code should use.
 //
 // When functions with a color precision higher than 8 bits are added, the
 // parameters of all color taking or returning functions must be changed to a higher
 // value (32 or 64 bits).
+//
+// convertFormat does not use {read,write}Pixel for byte aligned formats since
+// that is way too slow for full window buffers. For every pair of byte aligned formats
+// a row kernel is instantiated at compile time from the FormatTraits of both
+// formats (see kernelTable), where all the shifts and masks are constants.
+// Converting between the 24 and 32 bit rgb(a) formats is additionally only a
+// byte shuffle (in memory order), which can be done with simd instructions
+// if the cpu supports them (decided at runtime).
+
+namespace ny {
+namespace {
+
+using detail::nativeLittleEndian;
+using detail::bitMask;
+using detail::loadWord;
+using detail::storeWord;
+
+// Functions to read and write a single pixel of a byte aligned format.
+// readPixel/writePixel dispatch to the PixelFormat of the given format with
+// these, so the format is checked only once per pixel.
+struct PixelAccess {
+	nytl::Vec4u8 (*read)(const uint8_t*);
+	void (*write)(uint8_t*, nytl::Vec4u8);
+};
+
+template<unsigned int I>
+constexpr PixelAccess makePixelAccess()
+{
+	constexpr auto format = static_cast<ImageFormat>(I);
+	using Traits = FormatTraits<format>;
+	if constexpr(Traits::bits && Traits::byteAligned) {
+		return {&PixelFormat<format>::read, &PixelFormat<format>::write};
+	} else {
+		return {nullptr, nullptr};
+	}
+}
+
+template<std::size_t... I>
+constexpr std::array<PixelAccess, sizeof...(I)> makePixelAccessTable(std::index_sequence<I...>)
+{
+	return {{makePixelAccess<I>()...}};
+}
+
+constexpr auto pixelAccessTable = makePixelAccessTable(std::make_index_sequence<formatCount>());
+
+const PixelAccess& pixelAccess(ImageFormat format)
+{
+	return pixelAccessTable[static_cast<unsigned int>(format)];
+}
+
+// Scales a channel value from one channel size (in bits) to another.
+constexpr uint32_t scaleChannel(uint32_t value, unsigned int from, unsigned int to)
+{
+	if(from == to) return value;
+	auto fromMax = bitMask(from);
+	return (value * bitMask(to) + fromMax / 2) / fromMax;
+}
+
+// Returns channel c of the given word in format from, converted into its
+// position in format to. Missing alpha channels are set to their max value,
+// missing color channels to 0.
+constexpr uint32_t convertChannel(uint32_t word, const FormatInfo& from,
+	const FormatInfo& to, unsigned int c)
+{
+	if(!to.size[c]) return 0u;
+	if(!from.size[c]) return c == 3 ? bitMask(to.size[c]) << to.shift[c] : 0u;
+
+	auto value = (word >> from.shift[c]) & bitMask(from.size[c]);
+	return scaleChannel(value, from.size[c], to.size[c]) << to.shift[c];
+}
+
+// Converts a row of pixels between two byte aligned formats.
+// Since everything about the formats is known at compile time, the compiler
+// can fold all shifts and masks and unroll the channel loop.
+template<ImageFormat From, ImageFormat To, std::size_t... C>
+uint32_t convertWord(uint32_t word, std::index_sequence<C...>)
+{
+	constexpr auto& from = FormatTraits<From>::info;
+	constexpr auto& to = FormatTraits<To>::info;
+	return (convertChannel(word, from, to, C) | ...);
+}
+
+template<ImageFormat From, ImageFormat To>
+void convertRowT(const uint8_t* src, uint8_t* dst, unsigned int width)
+{
+	using F = FormatTraits<From>;
+	using T = FormatTraits<To>;
+
+	for(auto x = 0u; x < width; ++x) {
+		auto word = loadWord<F::bytes>(src);
+		auto out = convertWord<From, To>(word, std::make_index_sequence<4>());
+		storeWord<T::bytes>(dst, out);
+
+		src += F::bytes;
+		dst += T::bytes;
+	}
+}
+
+using FormatKernel = void(*)(const uint8_t* src, uint8_t* dst, unsigned int width);
+
+template<unsigned int From, unsigned int To>
+constexpr FormatKernel formatKernel()
+{
+	using F = FormatTraits<static_cast<ImageFormat>(From)>;
+	using T = FormatTraits<static_cast<ImageFormat>(To)>;
+
+	if constexpr(F::bits && T::bits && F::byteAligned && T::byteAligned) {
+		return &convertRowT<F::format, T::format>;
+	} else {
+		return nullptr;
+	}
+}
+
+template<std::size_t... I>
+constexpr std::array<FormatKernel, sizeof...(I)> makeKernelTable(std::index_sequence<I...>)
+{
+	return {{formatKernel<I / formatCount, I % formatCount>()...}};
+}
+
+// Row kernels for all format combinations, indexed by from * formatCount + to.
+// Holds nullptr for combinations that have no row kernel (e.g. for a1).
+constexpr auto kernelTable = makeKernelTable(std::make_index_sequence<formatCount * formatCount>());
+
+FormatKernel formatKernel(ImageFormat from, ImageFormat to)
+{
+	auto f = static_cast<unsigned int>(from);
+	auto t = static_cast<unsigned int>(to);
+	return kernelTable[f * formatCount + t];
+}
+
+// Describes how to convert one pixel between two formats whose channels are
+// all byte aligned. map holds for every destination byte (in memory order)
+// the source byte it is copied from, or -1 if it is an alpha byte that the
+// source format does not have (it will then be set to 0xFF).
+struct Swizzle {
+	unsigned int srcSize; // bytes per source pixel (3 or 4)
+	unsigned int dstSize; // bytes per destination pixel (3 or 4)
+	std::array<int, 4> map {-1, -1, -1, -1};
+};
+
+using RowKernel = void(*)(const Swizzle&, const uint8_t* src, uint8_t* dst, unsigned int width);
+
+// Returns the memory byte index of the r, g, b and a channel for the given format
+// on this machine or -1 for channels the format does not have.
+// Returns false if the format is not a 24 or 32 bit byte-permutation format.
+bool channelBytes(ImageFormat format, std::array<int, 4>& bytes)
+{
+	auto& info = formatInfo(format);
+	if(info.bits != 24 && info.bits != 32) return false;
+
+	for(auto c = 0u; c < 4u; ++c) {
+		if(!info.size[c] && c == 3) {
+			bytes[c] = -1;
+			continue;
+		}
+
+		if(info.size[c] != 8 || info.shift[c] % 8) return false;
+
+		// shift is counted from the least significant bit of the word
+		bytes[c] = nativeLittleEndian ? info.shift[c] / 8 : (info.bits - 8 - info.shift[c]) / 8;
+	}
+
+	return true;
+}
+
+bool makeSwizzle(ImageFormat from, ImageFormat to, Swizzle& swizzle)
+{
+	std::array<int, 4> src, dst;
+	if(!channelBytes(from, src) || !channelBytes(to, dst)) return false;
+
+	swizzle.srcSize = byteSize(from);
+	swizzle.dstSize = byteSize(to);
+	for(auto c = 0u; c < 4u; ++c)
+		if(dst[c] >= 0) swizzle.map[dst[c]] = src[c];
+
+	return true;
+}
+
+#ifdef NY_IMAGE_X86
+
+struct CpuFeatures {
+	bool sse2 {};
+	bool ssse3 {};
+	bool avx2 {};
+};
+
+const CpuFeatures& cpuFeatures()
+{
+	static const CpuFeatures features = []{
+		CpuFeatures ret;
+		__builtin_cpu_init();
+		ret.sse2 = __builtin_cpu_supports("sse2");
+		ret.ssse3 = __builtin_cpu_supports("ssse3");
+		ret.avx2 = __builtin_cpu_supports("avx2");
+		return ret;
+	}();
+
+	return features;
+}
+
+// Used for the pixels at the end of a row the simd kernels don't handle.
+void convertRowScalar(const Swizzle& s, const uint8_t* src, uint8_t* dst, unsigned int width)
+{
+	// byte 4 of pixel is the fill value for missing alpha channels
+	std::array<unsigned int, 4> index;
+	for(auto i = 0u; i < 4u; ++i) index[i] = s.map[i] < 0 ? 4u : s.map[i];
+
+	uint8_t pixel[5] {0, 0, 0, 0, 0xFF};
+	for(auto x = 0u; x < width; ++x) {
+		std::memcpy(pixel, src, s.srcSize);
+		for(auto i = 0u; i < s.dstSize; ++i) dst[i] = pixel[index[i]];
+		src += s.srcSize;
+		dst += s.dstSize;
+	}
+}
+
+// Builds the pshufb mask and alpha fill for 4 pixels at once.
+// Bytes with the high bit set in the mask are zeroed by the shuffle and then
+// or'ed with the fill value.
+__attribute__((target("ssse3")))
+void shuffleMask(const Swizzle& s, __m128i& mask, __m128i& fill)
+{
+	alignas(16) uint8_t maskData[16];
+	alignas(16) uint8_t fillData[16] {};
+	std::memset(maskData, 0x80, sizeof(maskData));
+
+	for(auto p = 0u; p < 4u; ++p) {
+		for(auto i = 0u; i < s.dstSize; ++i) {
+			auto idx = p * s.dstSize + i;
+			if(s.map[i] < 0) fillData[idx] = 0xFF;
+			else maskData[idx] = p * s.srcSize + s.map[i];
+		}
+	}
+
+	mask = _mm_load_si128(reinterpret_cast<const __m128i*>(maskData));
+	fill = _mm_load_si128(reinterpret_cast<const __m128i*>(fillData));
+}
+
+__attribute__((target("ssse3")))
+void convertRowSsse3(const Swizzle& s, const uint8_t* src, uint8_t* dst, unsigned int width)
+{
+	__m128i mask, fill;
+	shuffleMask(s, mask, fill);
+
+	// we always load 16 bytes, so there must be enough pixels left in the row
+	auto minPixels = (16u + s.srcSize - 1) / s.srcSize;
+	auto x = 0u;
+	for(; width - x >= minPixels; x += 4) {
+		auto in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+		auto out = _mm_or_si128(_mm_shuffle_epi8(in, mask), fill);
+		if(s.dstSize == 4) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), out);
+		} else {
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(dst), out);
+			auto high = _mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+			std::memcpy(dst + 8, &high, 4);
+		}
+
+		src += 4 * s.srcSize;
+		dst += 4 * s.dstSize;
+	}
+
+	convertRowScalar(s, src, dst, width - x);
+}
+
+__attribute__((target("avx2")))
+void convertRowAvx2(const Swizzle& s, const uint8_t* src, uint8_t* dst, unsigned int width)
+{
+	// only used for 32 bit -> 32 bit, then no pixel crosses the 128 bit lanes
+	// and we can use the 4 pixel shuffle mask for both lanes.
+	__m128i mask, fill;
+	shuffleMask(s, mask, fill);
+	auto mask256 = _mm256_broadcastsi128_si256(mask);
+	auto fill256 = _mm256_broadcastsi128_si256(fill);
+
+	auto x = 0u;
+	for(; width - x >= 8; x += 8) {
+		auto in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+		auto out = _mm256_or_si256(_mm256_shuffle_epi8(in, mask256), fill256);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), out);
+		src += 32;
+		dst += 32;
+	}
+
+	convertRowSsse3(s, src, dst, width - x);
+}
+
+#endif // NY_IMAGE_X86
+
+// Returns the simd kernel for the given swizzle or nullptr if there is none
+// this cpu supports.
+RowKernel simdKernel(const Swizzle& s)
+{
+	#ifdef NY_IMAGE_X86
+		auto& cpu = cpuFeatures();
+		if(cpu.avx2 && s.srcSize == 4 && s.dstSize == 4) return &convertRowAvx2;
+		if(cpu.ssse3) return &convertRowSsse3;
+	#else
+		(void) s;
+	#endif
+
+	return nullptr;
+}
+
+// Row kernels for premultiply and unpremultiply of 32 bit formats with 8 bit
+// channels. A is the memory index of the alpha byte in every pixel.
+using AlphaKernel = void(*)(uint8_t* row, unsigned int width, bool resetAlpha);
+
+// Exact round(c * a / 255) without division.
+inline uint8_t mulAlpha(unsigned int c, unsigned int a)
+{
+	auto t = c * a + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+// Exact round(c * 255 / a), clamped for invalid (c > a) values.
+inline uint8_t divAlpha(unsigned int c, unsigned int a)
+{
+	return a ? std::min(255u, (c * 255 + a / 2) / a) : 0u;
+}
+
+template<unsigned int A>
+void premultiplyRowScalar(uint8_t* row, unsigned int width, bool resetAlpha)
+{
+	for(auto x = 0u; x < width; ++x, row += 4) {
+		auto alpha = row[A];
+		for(auto i = 0u; i < 4u; ++i) if(i != A) row[i] = mulAlpha(row[i], alpha);
+		if(resetAlpha) row[A] = 0;
+	}
+}
+
+template<unsigned int A>
+void unpremultiplyRowScalar(uint8_t* row, unsigned int width, bool)
+{
+	for(auto x = 0u; x < width; ++x, row += 4) {
+		auto alpha = row[A];
+		for(auto i = 0u; i < 4u; ++i) if(i != A) row[i] = divAlpha(row[i], alpha);
+	}
+}
+
+#ifdef NY_IMAGE_X86
+
+// The 16 bit lanes holding the alpha values when unpacking pixels to 16 bit.
+template<unsigned int A>
+__attribute__((target("sse2")))
+__m128i alphaLanes()
+{
+	constexpr short s = -1;
+	return _mm_setr_epi16(A == 0 ? s : 0, A == 1 ? s : 0, A == 2 ? s : 0, A == 3 ? s : 0,
+		A == 0 ? s : 0, A == 1 ? s : 0, A == 2 ? s : 0, A == 3 ? s : 0);
+}
+
+// Premultiplies 2 pixels unpacked to 16 bit lanes. Multiplies the alpha
+// lanes with 255 so they stay as they are.
+template<unsigned int A>
+__attribute__((target("sse2")))
+__m128i premultiplySse2(__m128i px, __m128i lanes)
+{
+	constexpr auto imm = A * 0x55;
+	auto alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, imm), imm);
+	alpha = _mm_or_si128(_mm_andnot_si128(lanes, alpha), _mm_and_si128(lanes, _mm_set1_epi16(255)));
+	auto t = _mm_add_epi16(_mm_mullo_epi16(px, alpha), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+template<unsigned int A>
+__attribute__((target("sse2")))
+void premultiplyRowSse2(uint8_t* row, unsigned int width, bool resetAlpha)
+{
+	auto lanes = alphaLanes<A>();
+	auto keep = resetAlpha ? _mm_andnot_si128(lanes, _mm_set1_epi16(-1)) : _mm_set1_epi16(-1);
+	auto zero = _mm_setzero_si128();
+
+	auto x = 0u;
+	for(; x + 4 <= width; x += 4, row += 16) {
+		auto px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+		auto lo = premultiplySse2<A>(_mm_unpacklo_epi8(px, zero), lanes);
+		auto hi = premultiplySse2<A>(_mm_unpackhi_epi8(px, zero), lanes);
+		lo = _mm_and_si128(lo, keep);
+		hi = _mm_and_si128(hi, keep);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(row), _mm_packus_epi16(lo, hi));
+	}
+
+	premultiplyRowScalar<A>(row, width - x, resetAlpha);
+}
+
+template<unsigned int A>
+__attribute__((target("avx2")))
+void premultiplyRowAvx2(uint8_t* row, unsigned int width, bool resetAlpha)
+{
+	auto lanes = _mm256_broadcastsi128_si256(alphaLanes<A>());
+	auto keep = resetAlpha ? _mm256_andnot_si256(lanes, _mm256_set1_epi16(-1)) :
+		_mm256_set1_epi16(-1);
+	auto zero = _mm256_setzero_si256();
+	auto max = _mm256_set1_epi16(255);
+	auto half = _mm256_set1_epi16(128);
+	constexpr auto imm = A * 0x55;
+
+	// unpack and pack both work inside the 128 bit lanes, so the pixel order is kept
+	auto x = 0u;
+	for(; x + 8 <= width; x += 8, row += 32) {
+		auto px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row));
+		__m256i res[2];
+		for(auto i = 0u; i < 2u; ++i) {
+			auto v = i == 0 ? _mm256_unpacklo_epi8(px, zero) : _mm256_unpackhi_epi8(px, zero);
+			auto alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, imm), imm);
+			alpha = _mm256_or_si256(_mm256_andnot_si256(lanes, alpha), _mm256_and_si256(lanes, max));
+			auto t = _mm256_add_epi16(_mm256_mullo_epi16(v, alpha), half);
+			t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+			res[i] = _mm256_and_si256(t, keep);
+		}
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(row), _mm256_packus_epi16(res[0], res[1]));
+	}
+
+	premultiplyRowSse2<A>(row, width - x, resetAlpha);
+}
+
+// Unpremultiplies one pixel in 32 bit float lanes. Computing c * 255 / a
+// as single division and then adding 0.5 gives exactly the integer result
+// for all c <= a, larger values are clamped anyways.
+template<unsigned int A>
+__attribute__((target("sse2")))
+__m128i unpremultiplySse2(__m128i px, __m128 lanes)
+{
+	auto color = _mm_cvtepi32_ps(px);
+	auto alpha = _mm_shuffle_ps(color, color, A * 0x55);
+	auto res = _mm_div_ps(_mm_mul_ps(color, _mm_set1_ps(255.f)), alpha);
+	res = _mm_min_ps(_mm_add_ps(res, _mm_set1_ps(0.5f)), _mm_set1_ps(255.f));
+	res = _mm_and_ps(res, _mm_cmpneq_ps(alpha, _mm_setzero_ps()));
+	res = _mm_or_ps(_mm_andnot_ps(lanes, res), _mm_and_ps(lanes, color));
+	return _mm_cvttps_epi32(res);
+}
+
+template<unsigned int A>
+__attribute__((target("sse2")))
+void unpremultiplyRowSse2(uint8_t* row, unsigned int width, bool)
+{
+	auto lanes = _mm_castsi128_ps(_mm_setr_epi32(A == 0 ? -1 : 0, A == 1 ? -1 : 0,
+		A == 2 ? -1 : 0, A == 3 ? -1 : 0));
+	auto zero = _mm_setzero_si128();
+
+	auto x = 0u;
+	for(; x + 4 <= width; x += 4, row += 16) {
+		auto px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+		auto lo = _mm_unpacklo_epi8(px, zero);
+		auto hi = _mm_unpackhi_epi8(px, zero);
+
+		auto p0 = unpremultiplySse2<A>(_mm_unpacklo_epi16(lo, zero), lanes);
+		auto p1 = unpremultiplySse2<A>(_mm_unpackhi_epi16(lo, zero), lanes);
+		auto p2 = unpremultiplySse2<A>(_mm_unpacklo_epi16(hi, zero), lanes);
+		auto p3 = unpremultiplySse2<A>(_mm_unpackhi_epi16(hi, zero), lanes);
+
+		auto res = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(row), res);
+	}
+
+	unpremultiplyRowScalar<A>(row, width - x, false);
+}
+
+template<unsigned int A>
+__attribute__((target("avx2")))
+void unpremultiplyRowAvx2(uint8_t* row, unsigned int width, bool)
+{
+	constexpr auto blend = (1 << A) | (1 << (A + 4));
+	auto max = _mm256_set1_ps(255.f);
+	auto half = _mm256_set1_ps(0.5f);
+	auto zero = _mm256_setzero_ps();
+
+	// 2 pixels per iteration, one in each 128 bit lane
+	auto x = 0u;
+	for(; x + 2 <= width; x += 2, row += 8) {
+		auto px = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row));
+		auto color = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(px));
+		auto alpha = _mm256_shuffle_ps(color, color, A * 0x55);
+		auto res = _mm256_div_ps(_mm256_mul_ps(color, max), alpha);
+		res = _mm256_min_ps(_mm256_add_ps(res, half), max);
+		res = _mm256_and_ps(res, _mm256_cmp_ps(alpha, zero, _CMP_NEQ_OQ));
+		res = _mm256_blend_ps(res, color, blend);
+
+		auto ints = _mm256_cvttps_epi32(res);
+		auto packed = _mm_packs_epi32(_mm256_castsi256_si128(ints),
+			_mm256_extracti128_si256(ints, 1));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(row), _mm_packus_epi16(packed, packed));
+	}
+
+	unpremultiplyRowScalar<A>(row, width - x, false);
+}
+
+#endif // NY_IMAGE_X86
+
+// Returns the best premultiply (or unpremultiply if inverse) row kernel
+// for the given alpha byte this cpu supports.
+AlphaKernel alphaKernel(unsigned int alphaByte, bool inverse)
+{
+	static constexpr AlphaKernel scalar[2][4] = {
+		{&premultiplyRowScalar<0>, &premultiplyRowScalar<1>,
+			&premultiplyRowScalar<2>, &premultiplyRowScalar<3>},
+		{&unpremultiplyRowScalar<0>, &unpremultiplyRowScalar<1>,
+			&unpremultiplyRowScalar<2>, &unpremultiplyRowScalar<3>},
+	};
+
+	#ifdef NY_IMAGE_X86
+		static constexpr AlphaKernel sse2[2][4] = {
+			{&premultiplyRowSse2<0>, &premultiplyRowSse2<1>,
+				&premultiplyRowSse2<2>, &premultiplyRowSse2<3>},
+			{&unpremultiplyRowSse2<0>, &unpremultiplyRowSse2<1>,
+				&unpremultiplyRowSse2<2>, &unpremultiplyRowSse2<3>},
+		};
+
+		static constexpr AlphaKernel avx2[2][4] = {
+			{&premultiplyRowAvx2<0>, &premultiplyRowAvx2<1>,
+				&premultiplyRowAvx2<2>, &premultiplyRowAvx2<3>},
+			{&unpremultiplyRowAvx2<0>, &unpremultiplyRowAvx2<1>,
+				&unpremultiplyRowAvx2<2>, &unpremultiplyRowAvx2<3>},
+		};
+
+		auto& cpu = cpuFeatures();
+		if(cpu.avx2) return avx2[inverse][alphaByte];
+		if(cpu.sse2) return sse2[inverse][alphaByte];
+	#endif
+
+	return scalar[inverse][alphaByte];
+}
+
+// Row kernels for compositing a premultiplied source row onto a destination row
+// of the same 32 bit format with 8 bit channels. A is the memory index of the
+// alpha byte, alpha the constant alpha the source is modulated with.
+using CompositeKernel = void(*)(const uint8_t* src, uint8_t* dst, unsigned int width,
+	unsigned int alpha);
+
+template<unsigned int A>
+void overRowScalar(const uint8_t* src, uint8_t* dst, unsigned int width, unsigned int alpha)
+{
+	for(auto x = 0u; x < width; ++x, src += 4, dst += 4) {
+		auto inv = 255u - mulAlpha(src[A], alpha);
+		for(auto i = 0u; i < 4u; ++i) {
+			unsigned int value = mulAlpha(src[i], alpha) + mulAlpha(dst[i], inv);
+			dst[i] = std::min(255u, value);
+		}
+	}
+}
+
+void sourceRowScalar(const uint8_t* src, uint8_t* dst, unsigned int width, unsigned int alpha)
+{
+	if(alpha == 255u) {
+		std::memcpy(dst, src, width * 4);
+		return;
+	}
+
+	for(auto i = 0u; i < width * 4; ++i) dst[i] = mulAlpha(src[i], alpha);
+}
+
+#ifdef NY_IMAGE_X86
+
+// Computes round(a * b / 255) for all 16 bit lanes.
+__attribute__((target("sse2")))
+inline __m128i mulAlphaSse2(__m128i a, __m128i b)
+{
+	auto t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+inline __m256i mulAlphaAvx2(__m256i a, __m256i b)
+{
+	auto t = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Blends 2 source pixels over 2 destination pixels unpacked to 16 bit lanes.
+template<unsigned int A>
+__attribute__((target("sse2")))
+__m128i overSse2(__m128i src, __m128i dst, __m128i alpha, bool modulate)
+{
+	constexpr auto imm = A * 0x55;
+	if(modulate) src = mulAlphaSse2(src, alpha);
+	auto inv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, imm), imm);
+	inv = _mm_sub_epi16(_mm_set1_epi16(255), inv);
+	return _mm_add_epi16(src, mulAlphaSse2(dst, inv));
+}
+
+template<unsigned int A>
+__attribute__((target("sse2")))
+void overRowSse2(const uint8_t* src, uint8_t* dst, unsigned int width, unsigned int alpha)
+{
+	auto zero = _mm_setzero_si128();
+	auto alphas = _mm_set1_epi16(alpha);
+	auto modulate = alpha != 255u;
+
+	auto alphaMask = _mm_set1_epi32(0xFFu << (8 * A));
+
+	auto x = 0u;
+	for(; x + 4 <= width; x += 4, src += 16, dst += 16) {
+		auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+
+		// skip fully transparent and copy fully opaque blocks
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(s, zero)) == 0xFFFF) continue;
+		auto opaque = _mm_cmpeq_epi32(_mm_and_si128(s, alphaMask), alphaMask);
+		if(!modulate && _mm_movemask_epi8(opaque) == 0xFFFF) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), s);
+			continue;
+		}
+
+		auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+		auto lo = overSse2<A>(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero),
+			alphas, modulate);
+		auto hi = overSse2<A>(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero),
+			alphas, modulate);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+	}
+
+	overRowScalar<A>(src, dst, width - x, alpha);
+}
+
+template<unsigned int A>
+__attribute__((target("avx2")))
+void overRowAvx2(const uint8_t* src, uint8_t* dst, unsigned int width, unsigned int alpha)
+{
+	constexpr auto imm = A * 0x55;
+	auto zero = _mm256_setzero_si256();
+	auto max = _mm256_set1_epi16(255);
+	auto alphas = _mm256_set1_epi16(alpha);
+	auto modulate = alpha != 255u;
+
+	auto alphaMask = _mm256_set1_epi32(0xFFu << (8 * A));
+
+	auto x = 0u;
+	for(; x + 8 <= width; x += 8, src += 32, dst += 32) {
+		auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+
+		// skip fully transparent and copy fully opaque blocks
+		if(_mm256_testz_si256(s, s)) continue;
+		auto opaque = _mm256_cmpeq_epi32(_mm256_and_si256(s, alphaMask), alphaMask);
+		if(!modulate && _mm256_movemask_epi8(opaque) == -1) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), s);
+			continue;
+		}
+
+		auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst));
+
+		__m256i res[2];
+		for(auto i = 0u; i < 2u; ++i) {
+			auto sv = i == 0 ? _mm256_unpacklo_epi8(s, zero) : _mm256_unpackhi_epi8(s, zero);
+			auto dv = i == 0 ? _mm256_unpacklo_epi8(d, zero) : _mm256_unpackhi_epi8(d, zero);
+			if(modulate) sv = mulAlphaAvx2(sv, alphas);
+			auto inv = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sv, imm), imm);
+			res[i] = _mm256_add_epi16(sv, mulAlphaAvx2(dv, _mm256_sub_epi16(max, inv)));
+		}
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_packus_epi16(res[0], res[1]));
+	}
+
+	overRowSse2<A>(src, dst, width - x, alpha);
+}
+
+__attribute__((target("avx2")))
+void sourceRowAvx2(const uint8_t* src, uint8_t* dst, unsigned int width, unsigned int alpha)
+{
+	if(alpha == 255u) {
+		std::memcpy(dst, src, width * 4);
+		return;
+	}
+
+	auto zero = _mm256_setzero_si256();
+	auto alphas = _mm256_set1_epi16(alpha);
+
+	auto x = 0u;
+	for(; x + 8 <= width; x += 8, src += 32, dst += 32) {
+		auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+		auto lo = mulAlphaAvx2(_mm256_unpacklo_epi8(s, zero), alphas);
+		auto hi = mulAlphaAvx2(_mm256_unpackhi_epi8(s, zero), alphas);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_packus_epi16(lo, hi));
+	}
+
+	sourceRowScalar(src, dst, width - x, alpha);
+}
+
+__attribute__((target("sse2")))
+void sourceRowSse2(const uint8_t* src, uint8_t* dst, unsigned int width, unsigned int alpha)
+{
+	if(alpha == 255u) {
+		std::memcpy(dst, src, width * 4);
+		return;
+	}
+
+	auto zero = _mm_setzero_si128();
+	auto alphas = _mm_set1_epi16(alpha);
+
+	auto x = 0u;
+	for(; x + 4 <= width; x += 4, src += 16, dst += 16) {
+		auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+		auto lo = mulAlphaSse2(_mm_unpacklo_epi8(s, zero), alphas);
+		auto hi = mulAlphaSse2(_mm_unpackhi_epi8(s, zero), alphas);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+	}
+
+	sourceRowScalar(src, dst, width - x, alpha);
+}
+
+#endif // NY_IMAGE_X86
+
+// Returns the best kernel for the given operation (over or src) and alpha
+// byte this cpu supports.
+CompositeKernel compositeKernel(CompositeOp op, unsigned int alphaByte)
+{
+	static constexpr CompositeKernel overScalar[4] = {&overRowScalar<0>, &overRowScalar<1>,
+		&overRowScalar<2>, &overRowScalar<3>};
+
+	#ifdef NY_IMAGE_X86
+		static constexpr CompositeKernel overSse2[4] = {&overRowSse2<0>, &overRowSse2<1>,
+			&overRowSse2<2>, &overRowSse2<3>};
+		static constexpr CompositeKernel overAvx2[4] = {&overRowAvx2<0>, &overRowAvx2<1>,
+			&overRowAvx2<2>, &overRowAvx2<3>};
+
+		auto& cpu = cpuFeatures();
+		if(cpu.avx2) return op == CompositeOp::over ? overAvx2[alphaByte] : &sourceRowAvx2;
+		if(cpu.sse2) return op == CompositeOp::over ? overSse2[alphaByte] : &sourceRowSse2;
+	#endif
+
+	return op == CompositeOp::over ? overScalar[alphaByte] : &sourceRowScalar;
+}
+
+// Fills larger than this many bytes use non-temporal stores where possible, since
+// the buffer would not fit into the cache anyways and the stores would only
+// evict everything else from it.
+constexpr auto nonTemporalThreshold = 8u * 1024u * 1024u;
+
+// Fills a row of width 32 bit pixels with the given (memory order) pixel value.
+using FillKernel = void(*)(uint8_t* row, unsigned int width, uint32_t pixel, bool stream);
+
+void fillRow32Scalar(uint8_t* row, unsigned int width, uint32_t pixel, bool)
+{
+	for(auto x = 0u; x < width; ++x) std::memcpy(row + 4 * x, &pixel, 4);
+}
+
+#ifdef NY_IMAGE_X86
+
+__attribute__((target("sse2")))
+void fillRow32Sse2(uint8_t* row, unsigned int width, uint32_t pixel, bool stream)
+{
+	auto value = _mm_set1_epi32(pixel);
+	auto x = 0u;
+
+	// streaming stores must be aligned, which we can only reach if the
+	// row is pixel aligned, otherwise the pattern would be shifted
+	auto address = static_cast<unsigned int>(reinterpret_cast<std::uintptr_t>(row) % 32);
+	if(stream && address % 4 == 0) {
+		auto head = std::min(width, ((16 - address % 16) % 16) / 4);
+		fillRow32Scalar(row, head, pixel, false);
+		for(x = head; x + 4 <= width; x += 4)
+			_mm_stream_si128(reinterpret_cast<__m128i*>(row + 4 * x), value);
+	} else {
+		for(; x + 4 <= width; x += 4)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(row + 4 * x), value);
+	}
+
+	fillRow32Scalar(row + 4 * x, width - x, pixel, false);
+}
+
+__attribute__((target("avx2")))
+void fillRow32Avx2(uint8_t* row, unsigned int width, uint32_t pixel, bool stream)
+{
+	auto value = _mm256_set1_epi32(pixel);
+	auto x = 0u;
+
+	auto address = static_cast<unsigned int>(reinterpret_cast<std::uintptr_t>(row) % 32);
+	if(stream && address % 4 == 0) {
+		auto head = std::min(width, ((32 - address % 32) % 32) / 4);
+		fillRow32Scalar(row, head, pixel, false);
+		for(x = head; x + 8 <= width; x += 8)
+			_mm256_stream_si256(reinterpret_cast<__m256i*>(row + 4 * x), value);
+	} else {
+		for(; x + 8 <= width; x += 8)
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(row + 4 * x), value);
+	}
+
+	fillRow32Scalar(row + 4 * x, width - x, pixel, false);
+}
+
+#endif // NY_IMAGE_X86
+
+FillKernel fillKernel()
+{
+	#ifdef NY_IMAGE_X86
+		auto& cpu = cpuFeatures();
+		if(cpu.avx2) return &fillRow32Avx2;
+		if(cpu.sse2) return &fillRow32Sse2;
+	#endif
+
+	return &fillRow32Scalar;
+}
+
+// Makes sure streaming stores are visible to other threads before returning.
+void storeFence()
+{
+	#ifdef NY_IMAGE_X86
+		_mm_sfence();
+	#endif
+}
+
+// Fills a row of width pixels with bytes bytes each with the given pixel.
+// Writes whole chunks of 16 pixels (a multiple of 16 bytes) at once.
+void fillRowBytes(uint8_t* row, unsigned int width, const uint8_t* pixel, unsigned int bytes)
+{
+	constexpr auto chunkPixels = 16u;
+	uint8_t chunk[chunkPixels * 4];
+	for(auto i = 0u; i < chunkPixels; ++i) std::memcpy(chunk + i * bytes, pixel, bytes);
+
+	auto x = 0u;
+	for(; x + chunkPixels <= width; x += chunkPixels)
+		std::memcpy(row + x * bytes, chunk, chunkPixels * bytes);
+	std::memcpy(row + x * bytes, chunk, (width - x) * bytes);
+}
+
+// Sets the bits [begin, begin + count) of row (counted from the most significant bit
+// of the first byte) to the given pattern.
+// Only for formats with less than 8 bits, i.e. pattern is repeated in every byte.
+void fillRowBits(uint8_t* row, unsigned int begin, unsigned int count, uint8_t pattern)
+{
+	row += begin / 8;
+	begin %= 8;
+
+	// first partial byte
+	if(begin) {
+		auto bits = std::min(count, 8 - begin);
+		auto mask = static_cast<uint8_t>(bitMask(bits) << (8 - begin - bits));
+		*row = (*row & ~mask) | (pattern & mask);
+		++row;
+		count -= bits;
+	}
+
+	std::memset(row, pattern, count / 8);
+	row += count / 8;
+
+	// last partial byte
+	if(count % 8) {
+		auto mask = static_cast<uint8_t>(bitMask(count % 8) << (8 - count % 8));
+		*row = (*row & ~mask) | (pattern & mask);
+	}
+}
+
+// Lookup tables for sRGB encoding and decoding. Decoding maps every 8 bit sRGB
+// value to its 16 bit linear value, encoding maps the upper 12 bits of a 16 bit
+// linear value to the nearest 8 bit sRGB value.
+struct SrgbTables {
+	std::array<uint16_t, 256 + 2> decode; // padding for 32 bit gathers
+	std::array<uint8_t, 4096 + 4> encode;
+};
+
+const SrgbTables& srgbTables()
+{
+	static const SrgbTables tables = []{
+		SrgbTables ret {};
+		for(auto i = 0u; i < 256u; ++i) {
+			auto s = i / 255.0;
+			auto l = (s <= 0.04045) ? s / 12.92 : std::pow((s + 0.055) / 1.055, 2.4);
+			ret.decode[i] = static_cast<uint16_t>(std::lround(l * 65535.0));
+		}
+
+		for(auto i = 0u; i < 4096u; ++i) {
+			auto l = (i * 16 + 8) / 65535.0; // center of the bucket
+			auto s = (l <= 0.0031308) ? l * 12.92 : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+			ret.encode[i] = static_cast<uint8_t>(std::lround(std::min(s, 1.0) * 255.0));
+		}
+
+		return ret;
+	}();
+
+	return tables;
+}
+
+// Alpha is always linear, it is only scaled between 8 and 16 bits.
+inline uint16_t expandAlpha(uint8_t a) { return a * 257u; }
+inline uint8_t shrinkAlpha(uint16_t a) { return (a * 255u + 32895u) >> 16; } // round(a / 257)
+
+// Decodes a row of sRGB pixels with the given size in bytes into linear rgba values.
+// bytes holds the memory index of the r, g, b and a channel in every pixel.
+void decodeSrgbRow(const uint8_t* src, uint16_t* dst, unsigned int width,
+	const std::array<int, 4>& bytes, unsigned int size)
+{
+	auto& table = srgbTables().decode;
+	for(auto x = 0u; x < width; ++x, src += size, dst += 4) {
+		dst[0] = table[src[bytes[0]]];
+		dst[1] = table[src[bytes[1]]];
+		dst[2] = table[src[bytes[2]]];
+		dst[3] = bytes[3] < 0 ? 65535u : expandAlpha(src[bytes[3]]);
+	}
+}
+
+void encodeSrgbRow(const uint16_t* src, uint8_t* dst, unsigned int width,
+	const std::array<int, 4>& bytes, unsigned int size)
+{
+	auto& table = srgbTables().encode;
+	for(auto x = 0u; x < width; ++x, src += 4, dst += size) {
+		dst[bytes[0]] = table[src[0] >> 4];
+		dst[bytes[1]] = table[src[1] >> 4];
+		dst[bytes[2]] = table[src[2] >> 4];
+		if(bytes[3] >= 0) dst[bytes[3]] = shrinkAlpha(src[3]);
+	}
+}
+
+#ifdef NY_IMAGE_X86
+
+// Gather versions for 32 bit formats, bytes must hold all 4 channels.
+// Every 32 bit lane holds one pixel, so the channels can be extracted with shifts.
+__attribute__((target("avx2")))
+void decodeSrgbRowAvx2(const uint8_t* src, uint16_t* dst, unsigned int width,
+	const std::array<int, 4>& bytes, unsigned int size)
+{
+	auto table = reinterpret_cast<const int*>(srgbTables().decode.data());
+	auto low = _mm256_set1_epi32(0xFFFF);
+	auto byte = _mm256_set1_epi32(0xFF);
+
+	__m256i shifts[4];
+	for(auto i = 0u; i < 4u; ++i) shifts[i] = _mm256_set1_epi32(8 * bytes[i]);
+
+	auto x = 0u;
+	for(; x + 8 <= width; x += 8, src += 32, dst += 32) {
+		auto px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+		auto r = _mm256_and_si256(_mm256_srlv_epi32(px, shifts[0]), byte);
+		auto g = _mm256_and_si256(_mm256_srlv_epi32(px, shifts[1]), byte);
+		auto b = _mm256_and_si256(_mm256_srlv_epi32(px, shifts[2]), byte);
+		auto a = _mm256_and_si256(_mm256_srlv_epi32(px, shifts[3]), byte);
+
+		r = _mm256_and_si256(_mm256_i32gather_epi32(table, r, 2), low);
+		g = _mm256_and_si256(_mm256_i32gather_epi32(table, g, 2), low);
+		b = _mm256_and_si256(_mm256_i32gather_epi32(table, b, 2), low);
+		a = _mm256_mullo_epi32(a, _mm256_set1_epi32(257));
+
+		auto rg = _mm256_or_si256(r, _mm256_slli_epi32(g, 16));
+		auto ba = _mm256_or_si256(b, _mm256_slli_epi32(a, 16));
+		auto lo = _mm256_unpacklo_epi32(rg, ba);
+		auto hi = _mm256_unpackhi_epi32(rg, ba);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 16),
+			_mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	decodeSrgbRow(src, dst, width - x, bytes, size);
+}
+
+__attribute__((target("avx2")))
+void encodeSrgbRowAvx2(const uint16_t* src, uint8_t* dst, unsigned int width,
+	const std::array<int, 4>& bytes, unsigned int size)
+{
+	auto table = reinterpret_cast<const int*>(srgbTables().encode.data());
+	auto byte = _mm256_set1_epi32(0xFF);
+	auto low = _mm256_set1_epi32(0xFFFF);
+
+	__m256i shifts[4];
+	for(auto i = 0u; i < 4u; ++i) shifts[i] = _mm256_set1_epi32(8 * bytes[i]);
+
+	auto x = 0u;
+	for(; x + 8 <= width; x += 8, src += 32, dst += 32) {
+		// pixels 0-3 and 4-7, reorder so every 128 bit lane holds 2 pixels of each
+		auto first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+		auto second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 16));
+		auto lo = _mm256_permute2x128_si256(first, second, 0x20); // pixels 0, 1, 4, 5
+		auto hi = _mm256_permute2x128_si256(first, second, 0x31); // pixels 2, 3, 6, 7
+
+		// rg and ba words of pixels 0, 1, 2, 3 | 4, 5, 6, 7
+		auto rg = _mm256_unpacklo_epi64(_mm256_shuffle_epi32(lo, 0x88), _mm256_shuffle_epi32(hi, 0x88));
+		auto ba = _mm256_unpacklo_epi64(_mm256_shuffle_epi32(lo, 0xDD), _mm256_shuffle_epi32(hi, 0xDD));
+
+		auto r = _mm256_srli_epi32(_mm256_and_si256(rg, low), 4);
+		auto g = _mm256_srli_epi32(rg, 20);
+		auto b = _mm256_srli_epi32(_mm256_and_si256(ba, low), 4);
+		r = _mm256_and_si256(_mm256_i32gather_epi32(table, r, 1), byte);
+		g = _mm256_and_si256(_mm256_i32gather_epi32(table, g, 1), byte);
+		b = _mm256_and_si256(_mm256_i32gather_epi32(table, b, 1), byte);
+		auto a = _mm256_mullo_epi32(_mm256_srli_epi32(ba, 16), _mm256_set1_epi32(255));
+		a = _mm256_srli_epi32(_mm256_add_epi32(a, _mm256_set1_epi32(32895)), 16);
+
+		auto out = _mm256_or_si256(
+			_mm256_or_si256(_mm256_sllv_epi32(r, shifts[0]), _mm256_sllv_epi32(g, shifts[1])),
+			_mm256_or_si256(_mm256_sllv_epi32(b, shifts[2]), _mm256_sllv_epi32(a, shifts[3])));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), out);
+	}
+
+	encodeSrgbRow(src, dst, width - x, bytes, size);
+}
+
+#endif // NY_IMAGE_X86
+
+// Converts a row in place, i.e. decodes to linear and stores the result with
+// 8 bits per channel (linear to srgb if inverse).
+void srgbRowInPlace(uint8_t* row, unsigned int width, const std::array<int, 4>& bytes,
+	unsigned int size, bool inverse)
+{
+	// 8 bit tables derived from the 16 bit ones
+	static const auto tables = []{
+		std::array<std::array<uint8_t, 256>, 2> ret;
+		auto& srgb = srgbTables();
+		for(auto i = 0u; i < 256u; ++i) {
+			ret[0][i] = (srgb.decode[i] * 255u + 32767u) / 65535u;
+			ret[1][i] = srgb.encode[(i * 257u) >> 4];
+		}
+
+		return ret;
+	}();
+
+	auto& table = tables[inverse];
+	for(auto x = 0u; x < width; ++x, row += size)
+		for(auto c = 0u; c < 3u; ++c)
+			row[bytes[c]] = table[row[bytes[c]]];
+}
+
+// Small pool of worker threads that is used by the parallel image operations
+// when no executor is given. The calling thread works on the tasks as well.
+class ThreadPool : public nytl::NonMovable {
+public:
+	ThreadPool(unsigned int workers)
+	{
+		for(auto i = 0u; i < workers; ++i) threads_.emplace_back([this]{ work(); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			exit_ = true;
+		}
 
-namespace ny {
+		cv_.notify_all();
+		for(auto& thread : threads_) thread.join();
+	}
 
-bool littleEndian()
+	unsigned int size() const { return threads_.size() + 1; }
+
+	// Calls task for all indices in [0, count) and waits until they are finished.
+	void run(unsigned int count, const std::function<void(unsigned int)>& task)
+	{
+		// only one batch at a time, there are not more threads anyways
+		std::lock_guard<std::mutex> runLock(runMutex_);
+
+		Batch batch {&task, count};
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			batch_ = &batch;
+			++generation_;
+		}
+
+		cv_.notify_all();
+		execute(batch);
+
+		// the batch lives on our stack, so wait until no worker uses it anymore
+		std::unique_lock<std::mutex> lock(mutex_);
+		doneCv_.wait(lock, [&]{ return batch.done == count && active_ == 0; });
+		batch_ = nullptr;
+	}
+
+protected:
+	struct Batch {
+		const std::function<void(unsigned int)>* task;
+		unsigned int count;
+		std::atomic<unsigned int> next {0};
+		std::atomic<unsigned int> done {0};
+	};
+
+	void execute(Batch& batch)
+	{
+		for(auto i = batch.next++; i < batch.count; i = batch.next++) {
+			(*batch.task)(i);
+			++batch.done;
+		}
+	}
+
+	void work()
+	{
+		auto seen = 0u;
+		std::unique_lock<std::mutex> lock(mutex_);
+		while(true) {
+			cv_.wait(lock, [&]{ return exit_ || (batch_ && generation_ != seen); });
+			if(exit_) return;
+
+			seen = generation_;
+			auto& batch = *batch_;
+			++active_;
+
+			lock.unlock();
+			execute(batch);
+			lock.lock();
+
+			--active_;
+			doneCv_.notify_all();
+		}
+	}
+
+	std::vector<std::thread> threads_;
+	std::mutex runMutex_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::condition_variable doneCv_;
+	Batch* batch_ {};
+	unsigned int generation_ {};
+	unsigned int active_ {};
+	bool exit_ {};
+};
+
+ThreadPool& threadPool()
 {
-	// Runtime test checking for little endianess.
-	constexpr uint32_t dummy = 1u;
-	return ((reinterpret_cast<const uint8_t*>(&dummy))[0] == 1);
+	static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+	return pool;
 }
 
-unsigned int bitSize(ImageFormat format)
+// Splits the rows of an image with the given size into bands and calls
+// func(begin, end) for each of them, concurrently if possible.
+// byteRows signals that no two rows share a byte, otherwise we stay serial.
+template<typename F>
+void forEachBand(nytl::Vec2ui size, bool byteRows, const ParallelSettings& settings, F&& func)
+{
+	auto rows = size[1];
+	auto pixels = static_cast<uint64_t>(size[0]) * size[1];
+	if(!byteRows || pixels < settings.threshold || rows < 2) {
+		func(0u, rows);
+		return;
+	}
+
+	auto bands = settings.bands;
+	if(!bands) bands = settings.executor ? std::thread::hardware_concurrency() : threadPool().size();
+	bands = std::min(bands, rows);
+	if(bands <= 1) {
+		func(0u, rows);
+		return;
+	}
+
+	auto task = [&](unsigned int i) {
+		auto begin = static_cast<uint64_t>(rows) * i / bands;
+		auto end = static_cast<uint64_t>(rows) * (i + 1) / bands;
+		func(static_cast<unsigned int>(begin), static_cast<unsigned int>(end));
+	};
+
+	if(settings.executor) settings.executor(bands, task);
+	else threadPool().run(bands, task);
+}
+
+// Converts the rows [begin, end) of img into the image at into with the given stride.
+// intoBit is the bit of into at which the first converted pixel is written.
+void convertRows(const Image& img, ImageFormat to, uint8_t& into, unsigned int newStride,
+	unsigned int begin, unsigned int end, unsigned int intoBit = 0u)
 {
-	using Format = ImageFormat;
-	switch(format) {
-		case Format::rgba8888:
-		case Format::argb8888:
-		case Format::abgr8888:
-		case Format::bgra8888:
-			return 32u;
+	// fast paths for byte aligned formats, see the note at the top.
+	// Sub-byte formats use the per-pixel loop, byteSize would round their pixels
+	// up to whole bytes and copying whole bytes would overwrite neighbouring pixels.
+	auto srcStride = bitStride(img);
+	auto byteFormats = bitSize(img.format) % 8 == 0 && bitSize(to) % 8 == 0;
+	if(byteFormats && srcStride % 8 == 0 && newStride % 8 == 0 && intoBit % 8 == 0) {
+		Swizzle swizzler;
+		RowKernel simd = nullptr;
+		if(makeSwizzle(img.format, to, swizzler)) simd = simdKernel(swizzler);
+		auto kernel = formatKernel(img.format, to);
 
-		case Format::rgb888:
-		case Format::bgr888:
-			return 24u;
+		if(img.format == to || simd || kernel) {
+			auto rowBytes = img.size[0] * byteSize(to);
+			for(auto y = begin; y < end; ++y) {
+				auto src = img.data + y * (srcStride / 8);
+				auto dst = &into + intoBit / 8 + y * (newStride / 8);
+				if(img.format == to) std::memcpy(dst, src, rowBytes);
+				else if(simd) simd(swizzler, src, dst, img.size[0]);
+				else kernel(src, dst, img.size[0]);
+			}
 
-		case Format::a8:
-			return 8u;
+			return;
+		}
+	}
 
-		case Format::a1:
-			return 1u;
+	// rows of the same sub-byte format starting at a byte can still be copied
+	// bytewise up to their last full byte, only the rest is written per pixel
+	// so that the following pixels in into are not overwritten
+	auto firstX = 0u;
+	auto bits = bitSize(to);
+	if(img.format == to && bits && 8 % bits == 0 && srcStride % 8 == 0 &&
+			newStride % 8 == 0 && intoBit % 8 == 0) {
+		auto fullBytes = (img.size[0] * bits) / 8;
+		for(auto y = begin; y < end && fullBytes; ++y) {
+			std::memcpy(&into + intoBit / 8 + y * (newStride / 8),
+				img.data + y * (srcStride / 8), fullBytes);
+		}
 
-		case Format::none: return 0u;
+		firstX = fullBytes * 8 / bits;
 	}
 
-	// should not be reached
-	return 0u;
+	auto& fromInfo = formatInfo(img.format);
+	auto& toInfo = formatInfo(to);
+	for(auto y = begin; y < end && firstX < img.size[0]; ++y) {
+		for(auto x = firstX; x < img.size[0]; ++x) {
+			auto color = readPixel(img, {x, y});
+			for(auto c = 0u; c < 4u; ++c) {
+				auto fromSize = fromInfo.size[c] ? fromInfo.size[c] : 8;
+				auto toSize = toInfo.size[c] ? toInfo.size[c] : 8;
+				color[c] = scaleChannel(color[c], fromSize, toSize);
+			}
+
+			auto bit = intoBit + y * newStride + x * bitSize(to);
+			writePixel(*(&into + bit / 8), to, color, bit % 8);
+		}
+	}
 }
 
-unsigned int byteSize(ImageFormat format)
+// Returns the bit of dst at which src is blitted, throws if it does not fit.
+unsigned int blitBit(const Image& src, const MutableImage& dst, nytl::Vec2ui pos)
 {
-	return std::ceil(bitSize(format) / 8.0);
+	if(pos[0] + src.size[0] > dst.size[0] || pos[1] + src.size[1] > dst.size[1])
+		throw std::out_of_range("ny::blit: source does not fit into destination");
+
+	return pos[1] * bitStride(dst) + pos[0] * bitSize(dst.format);
 }
 
-ImageFormat toggleByteWordOrder(ImageFormat format)
+// Composites the rows [begin, end) of src onto dst at the given pixel.
+void compositeRows(const Image& src, const MutableImage& dst, nytl::Vec2ui pos,
+	CompositeOp op, unsigned int alpha, unsigned int begin, unsigned int end)
 {
-	if(!littleEndian()) return format;
+	auto dstStride = bitStride(dst) / 8;
+	auto srcStride = bitStride(src) / 8;
+	auto rowBytes = src.size[0] * 4;
+
+	if(op == CompositeOp::clear || (op == CompositeOp::src && alpha == 0u)) {
+		for(auto y = begin; y < end; ++y)
+			std::memset(dst.data + (pos[1] + y) * dstStride + pos[0] * 4, 0, rowBytes);
+		return;
+	}
 
-	using Format = ImageFormat;
-	switch(format) {
-		case Format::rgba8888: return Format::abgr8888;
-		case Format::argb8888: return Format::bgra8888;
-		case Format::abgr8888: return Format::rgba8888;
-		case Format::bgra8888: return Format::argb8888;
-		case Format::rgb888: return Format::bgr888;
-		case Format::bgr888: return Format::rgb888;
-		case Format::a8:
-		case Format::a1:
-		case Format::none: return format;
+	std::array<int, 4> bytes;
+	channelBytes(dst.format, bytes);
+	auto kernel = compositeKernel(op, bytes[3]);
+
+	// if the formats differ, the source is converted in chunks on the stack first
+	Swizzle swizzler;
+	RowKernel simd = nullptr;
+	FormatKernel convert = nullptr;
+	if(src.format != dst.format) {
+		if(makeSwizzle(src.format, dst.format, swizzler)) simd = simdKernel(swizzler);
+		if(!simd) convert = formatKernel(src.format, dst.format);
 	}
 
-	// should not be reached
-	return Format::none;
+	constexpr auto chunk = 256u;
+	alignas(32) uint8_t buffer[chunk * 4];
+
+	for(auto y = begin; y < end; ++y) {
+		auto srow = src.data + y * srcStride;
+		auto drow = dst.data + (pos[1] + y) * dstStride + pos[0] * 4;
+		if(!simd && !convert) {
+			kernel(srow, drow, src.size[0], alpha);
+			continue;
+		}
+
+		for(auto x = 0u; x < src.size[0]; x += chunk) {
+			auto count = std::min(chunk, src.size[0] - x);
+			if(simd) simd(swizzler, srow + x * 4, buffer, count);
+			else convert(srow + x * 4, buffer, count);
+			kernel(buffer, drow + x * 4, count, alpha);
+		}
+	}
 }
 
-unsigned int pixelBit(const Image& image, nytl::Vec2ui pos)
+// Fills the rows [begin, end) of the given rect of img with the given color.
+void fillRows(const MutableImage& img, const nytl::Rect2ui& rect, nytl::Vec4u8 color,
+	unsigned int begin, unsigned int end)
+{
+	auto& info = formatInfo(img.format);
+	auto stride = bitStride(img);
+
+	// the pixel in memory order, packed only once
+	uint8_t pixel[4] {};
+	writePixel(*pixel, img.format, color);
+
+	if(info.bits % 8) {
+		// replicate the pixel (written at the start of the byte) into the full byte
+		uint8_t pattern = 0u;
+		auto value = pixel[0] >> (8 - info.bits);
+		for(auto i = 0u; i < 8u; i += info.bits) pattern |= value << (8 - i - info.bits);
+
+		for(auto y = begin; y < end; ++y) {
+			auto bit = (rect.position[1] + y) * stride + rect.position[0] * info.bits;
+			fillRowBits(img.data, bit, rect.size[0] * info.bits, pattern);
+		}
+
+		return;
+	}
+
+	auto bytes = info.bits / 8;
+	auto rowBytes = rect.size[0] * bytes;
+	auto row = [&](unsigned int y) {
+		return img.data + (rect.position[1] + y) * (stride / 8) + rect.position[0] * bytes;
+	};
+
+	// single bytes or all bytes equal: just memset
+	auto uniform = std::all_of(pixel, pixel + bytes, [&](auto b) { return b == pixel[0]; });
+	if(uniform) {
+		for(auto y = begin; y < end; ++y) std::memset(row(y), pixel[0], rowBytes);
+		return;
+	}
+
+	if(bytes == 4) {
+		auto kernel = fillKernel();
+		auto stream = static_cast<uint64_t>(rowBytes) * (end - begin) >= nonTemporalThreshold;
+		uint32_t value;
+		std::memcpy(&value, pixel, 4);
+
+		for(auto y = begin; y < end; ++y) kernel(row(y), rect.size[0], value, stream);
+		if(stream) storeFence();
+		return;
+	}
+
+	for(auto y = begin; y < end; ++y) fillRowBytes(row(y), rect.size[0], pixel, bytes);
+}
+
+// Checks that the given rect lies inside img.
+void checkRect(const Image& img, const nytl::Rect2ui& rect)
 {
-	return image.stride * pos[1] + bitSize(image.format) * pos[0];
+	if(rect.position[0] + rect.size[0] > img.size[0] ||
+			rect.position[1] + rect.size[1] > img.size[1])
+		throw std::out_of_range("ny::fillRect: rect out of range");
 }
 
-nytl::Vec4u8 readPixel(const uint8_t& pixel, ImageFormat format, unsigned int bitOffset)
+// Returns the channel bytes of the given image for the srgb functions
+// or throws if its format is not supported.
+std::array<int, 4> srgbChannels(const Image& img)
+{
+	std::array<int, 4> bytes;
+	if(!channelBytes(img.format, bytes) || bitStride(img) % 8)
+		throw std::invalid_argument("ny::srgb: only 24 and 32 bit formats supported");
+	return bytes;
+}
+
+// Checks the requirements of composite and returns whether there is anything to do.
+bool checkComposite(const Image& src, const MutableImage& dst, nytl::Vec2ui pos)
 {
-	unsigned int bytesToLoad = byteSize(format); // NOTE: must be changed for [2,7]-bit formats
-	std::array<uint8_t, 4> bytes {};
+	auto valid = [](const Image& img) {
+		std::array<int, 4> bytes;
+		return bitSize(img.format) == 32 && channelBytes(img.format, bytes) && bytes[3] >= 0 &&
+			bitStride(img) % 8 == 0;
+	};
 
-	// logical word-order bytes
-	bytes[0] = *(&pixel + (littleEndian() ? bytesToLoad - 1 : 0));
-	if(bytesToLoad > 1) bytes[1] = *(&pixel + (littleEndian() ? bytesToLoad - 2 : 1));
-	if(bytesToLoad > 2) bytes[2] = *(&pixel + (littleEndian() ? bytesToLoad - 3 : 2));
-	if(bytesToLoad > 3) bytes[3] = *(&pixel + (littleEndian() ? bytesToLoad - 4 : 3));
+	if(!valid(src) || !valid(dst))
+		throw std::invalid_argument("ny::composite: only 32 bit formats with alpha supported");
+
+	blitBit(src, dst, pos);
+	return src.size[0] && src.size[1];
+}
 
-	using Format = ImageFormat;
-	switch(format) {
-		case Format::rgba8888: return {bytes[0], bytes[1], bytes[2], bytes[3]};
-		case Format::argb8888: return {bytes[1], bytes[2], bytes[3], bytes[0]};
-		case Format::abgr8888: return {bytes[3], bytes[2], bytes[1], bytes[0]};
-		case Format::bgra8888: return {bytes[2], bytes[1], bytes[0], bytes[3]};
+// Marks the tiles of the given tile row whose pixels differ between prev and cur.
+// Tiles that are already dirty are not compared again, so mostly changed
+// images are not read completely.
+void diffTileRow(const Image& prev, const Image& cur, unsigned int tileSize,
+	unsigned int tileRow, std::vector<uint8_t>& dirty)
+{
+	auto begin = tileRow * tileSize;
+	auto end = std::min(begin + tileSize, cur.size[1]);
+	auto width = cur.size[0];
+	auto clean = static_cast<unsigned int>(dirty.size());
 
-		case Format::rgb888: return {bytes[0], bytes[1], bytes[2], 0};
-		case Format::bgr888: return {bytes[2], bytes[1], bytes[0], 0};
+	// rows with bit strides: compare the pixels one by one
+	if(bitStride(prev) % 8 || bitStride(cur) % 8) {
+		for(auto y = begin; y < end && clean; ++y) {
+			for(auto t = 0u; t < dirty.size(); ++t) {
+				if(dirty[t]) continue;
+				for(auto x = t * tileSize; x < std::min((t + 1) * tileSize, width); ++x) {
+					if(readPixel(prev, {x, y}) != readPixel(cur, {x, y})) {
+						dirty[t] = 1;
+						--clean;
+						break;
+					}
+				}
+			}
+		}
 
-		case Format::a8: return {0, 0, 0, bytes[0]};
-		case Format::a1: return {0, 0, 0, static_cast<uint8_t>(bytes[0] & (1 << (8 - bitOffset)))};
-		case Format::none: return {};
+		return;
 	}
 
-	// should not be reached
-	return {};
+	// for formats with less than 8 bits per pixel, the bytes at the tile borders
+	// are shared and compared with both tiles, which is just more conservative.
+	// memcmp is already vectorized and stops at the first difference
+	auto bits = bitSize(cur.format);
+	auto prevStride = bitStride(prev) / 8;
+	auto curStride = bitStride(cur) / 8;
+	for(auto y = begin; y < end && clean; ++y) {
+		auto prevRow = data(prev) + y * prevStride;
+		auto curRow = data(cur) + y * curStride;
+		for(auto t = 0u; t < dirty.size(); ++t) {
+			if(dirty[t]) continue;
+			auto first = (t * tileSize * bits) / 8;
+			auto last = (std::min((t + 1) * tileSize, width) * bits + 7) / 8;
+			if(std::memcmp(prevRow + first, curRow + first, last - first)) {
+				dirty[t] = 1;
+				--clean;
+			}
+		}
+	}
 }
 
-void writePixel(uint8_t& pixel, ImageFormat format, nytl::Vec4u8 color, unsigned int bitOffset)
+// Premultiplies (or unpremultiplies if inverse) the rows [begin, end) of img.
+void alphaRows(const MutableImage& img, bool inverse, bool resetAlpha, unsigned int begin,
+	unsigned int end)
+{
+	std::array<int, 4> bytes;
+	auto stride = bitStride(img);
+	if(stride % 8 == 0 && bitSize(img.format) == 32 && channelBytes(img.format, bytes)) {
+		auto kernel = alphaKernel(bytes[3], inverse);
+		for(auto y = begin; y < end; ++y)
+			kernel(img.data + y * (stride / 8), img.size[0], resetAlpha);
+
+		return;
+	}
+
+	// generic version for all other formats
+	auto& info = formatInfo(img.format);
+	auto alphaMax = bitMask(info.size[3]);
+	for(auto y = begin; y < end; ++y) {
+		for(auto x = 0u; x < img.size[0]; ++x) {
+			auto color = readPixel(img, {x, y});
+			auto alpha = color[3];
+			for(auto c = 0u; c < 3u; ++c) {
+				if(inverse) {
+					auto max = bitMask(info.size[c]);
+					color[c] = alpha ? std::min(max, (color[c] * alphaMax + alpha / 2) / alpha) : 0;
+				} else {
+					color[c] = (color[c] * alpha + alphaMax / 2) / alphaMax;
+				}
+			}
+
+			if(resetAlpha) color[3] = 0;
+			writePixel(img, {x, y}, color);
+		}
+	}
+}
+
+} // anonymous util namespace
+
+bool littleEndian()
+{
+	// Runtime test checking for little endianess.
+	constexpr uint32_t dummy = 1u;
+	return ((reinterpret_cast<const uint8_t*>(&dummy))[0] == 1);
+}
+
+unsigned int bitSize(ImageFormat format)
+{
+	return formatInfo(format).bits;
+}
+
+unsigned int byteSize(ImageFormat format)
+{
+	return (bitSize(format) + 7) / 8;
+}
+
+ImageFormat toggleByteWordOrder(const ImageFormat& format)
+{
+	auto& info = formatInfo(format);
+	if(!littleEndian() || info.bits <= 8) return format;
+
+	// the format with the same channels but at mirrored byte positions
+	for(auto i = 0u; i < formatCount; ++i) {
+		auto& other = formatInfos[i];
+		if(other.bits != info.bits || other.size != info.size) continue;
+
+		auto mirrored = true;
+		for(auto c = 0u; c < 4u && mirrored; ++c)
+			if(info.size[c] && other.shift[c] != info.bits - info.shift[c] - info.size[c])
+				mirrored = false;
+
+		if(mirrored) return static_cast<ImageFormat>(i);
+	}
+
+	return ImageFormat::none;
+}
+
+unsigned int pixelBit(const Image& image, nytl::Vec2ui pos)
+{
+	return bitStride(image) * pos[1] + bitSize(image.format) * pos[0];
+}
+
+nytl::Vec4u8 readPixel(const uint8_t& pixel, ImageFormat format, unsigned int bitOffset)
 {
-	unsigned int bytesToWrite = byteSize(format); // NOTE: must be changed for [2,7]-bit formats
-	std::array<uint8_t, 4> bytes {}; // word-order bytes to write
+	auto& access = pixelAccess(format);
+	if(access.read) return access.read(&pixel);
+
+	// sub-byte formats
+	auto& info = formatInfo(format);
+	if(!info.bits) return {};
 
-	using Format = ImageFormat;
-	switch(format) {
-		case Format::rgba8888: bytes = {color[0], color[1], color[2], color[3]}; break;
-		case Format::argb8888: bytes = {color[3], color[0], color[1], color[2]}; break;
-		case Format::abgr8888: bytes = {color[3], color[2], color[1], color[0]}; break;
-		case Format::bgra8888: bytes = {color[2], color[1], color[0], color[3]}; break;
+	auto word = (pixel >> (8 - bitOffset - info.bits)) & bitMask(info.bits);
+	nytl::Vec4u8 color {0, 0, 0, 255};
+	for(auto c = 0u; c < 4u; ++c)
+		if(info.size[c]) color[c] = (word >> info.shift[c]) & bitMask(info.size[c]);
 
-		case Format::rgb888: bytes = {color[0], color[1], color[2], 0}; break;
-		case Format::bgr888: bytes = {color[2], color[1], color[0], 0}; break;
+	return color;
+}
 
-		case Format::a8: bytes[3] = color[4]; break;
-		case Format::a1:
-			bytes[0] = pixel & ~(1 << (8 - bitOffset));
-		 	bytes[0] |= (color[3] & (1 << 8)) >> bitOffset;
-			break;
-		case Format::none: bytes = {};
+void writePixel(uint8_t& pixel, ImageFormat format, nytl::Vec4u8 color, unsigned int bitOffset)
+{
+	auto& access = pixelAccess(format);
+	if(access.write) {
+		access.write(&pixel, color);
+		return;
 	}
 
-	*(&pixel + 0) = bytes[littleEndian() ? bytesToWrite - 1 : 0];
-	if(bytesToWrite > 1) *(&pixel + 1) = bytes[littleEndian() ? bytesToWrite - 2 : 1];
-	if(bytesToWrite > 2) *(&pixel + 2) = bytes[littleEndian() ? bytesToWrite - 3 : 2];
-	if(bytesToWrite > 3) *(&pixel + 3) = bytes[littleEndian() ? bytesToWrite - 4 : 3];
+	// sub-byte formats
+	auto& info = formatInfo(format);
+	if(!info.bits) return;
+
+	uint32_t word = 0u;
+	for(auto c = 0u; c < 4u; ++c)
+		if(info.size[c]) word |= (color[c] & bitMask(info.size[c])) << info.shift[c];
+
+	auto shift = 8 - bitOffset - info.bits;
+	pixel = (pixel & ~(bitMask(info.bits) << shift)) | (word << shift);
 }
 
 nytl::Vec4u8 readPixel(const Image& img, nytl::Vec2ui pos)
@@ -166,10 +1561,12 @@ void writePixel(const MutableImage& img, nytl::Vec2ui pos, nytl::Vec4u8 color)
 
 nytl::Vec4f norm(nytl::Vec4u8 color, ImageFormat format)
 {
-	auto ret = static_cast<nytl::Vec4f>(color);
+	auto& info = formatInfo(format);
+	nytl::Vec4f ret;
+	for(auto c = 0u; c < 4u; ++c)
+		ret[c] = color[c] / static_cast<float>(bitMask(info.size[c] ? info.size[c] : 8));
 
-	if(format == ImageFormat::a1 || format == ImageFormat::none) return ret;
-	return (1 / 255.f) * ret;
+	return ret;
 }
 
 bool satisfiesRequirements(const Image& img, ImageFormat format, unsigned int strideAlign)
@@ -203,54 +1600,284 @@ void convertFormat(const Image& img, ImageFormat to, uint8_t& into, unsigned int
 
 	auto newStride = img.size[0] * bitSize(to);
 	if(alignNewStride) newStride = align(newStride, alignNewStride);
+	convertRows(img, to, into, newStride, 0, img.size[1]);
+}
 
-	for(auto y = 0u; y < img.size[1]; ++y) {
-		for(auto x = 0u; x < img.size[0]; ++x) {
-			auto color = readPixel(img, {x, y});
-			auto bit = y * newStride + x * bitSize(to);
-			writePixel(*(&into + bit / 8), to, color, bit % 8);
-		}
+UniqueImage convertFormat(const Image& img, ImageFormat to, unsigned int alignNewStride,
+	const ParallelSettings& settings)
+{
+	auto newStride = img.size[0] * bitSize(to);
+	if(alignNewStride) newStride = align(newStride, alignNewStride);
+
+	UniqueImage ret;
+	ret.data = std::make_unique<std::uint8_t[]>(std::ceil((newStride * img.size[1]) / 8.0));
+	ret.size = img.size;
+	ret.format = to;
+	ret.stride = newStride;
+	convertFormat(img, to, *ret.data.get(), alignNewStride, settings);
+
+	return ret;
+}
+
+void convertFormat(const Image& img, ImageFormat to, uint8_t& into, unsigned int alignNewStride,
+	const ParallelSettings& settings)
+{
+	// a single memcpy is faster than splitting it into bands
+	if(satisfiesRequirements(img, to, alignNewStride)) {
+		std::memcpy(&into, img.data, dataSize(img));
+		return;
 	}
+
+	auto newStride = img.size[0] * bitSize(to);
+	if(alignNewStride) newStride = align(newStride, alignNewStride);
+
+	auto byteRows = bitStride(img) % 8 == 0 && newStride % 8 == 0;
+	forEachBand(img.size, byteRows, settings, [&](unsigned int begin, unsigned int end) {
+		convertRows(img, to, into, newStride, begin, end);
+	});
 }
 
-bool alphaComponent(ImageFormat format)
+void copy(const Image& src, const MutableImage& dst, nytl::Vec2ui pos)
+{
+	if(src.format != dst.format)
+		throw std::invalid_argument("ny::copy: formats differ, use blit");
+
+	blit(src, dst, pos);
+}
+
+void blit(const Image& src, const MutableImage& dst, nytl::Vec2ui pos)
+{
+	auto bit = blitBit(src, dst, pos);
+	convertRows(src, dst.format, *dst.data, bitStride(dst), 0, src.size[1], bit);
+}
+
+void copy(const Image& src, const MutableImage& dst, nytl::Vec2ui pos,
+	const ParallelSettings& settings)
+{
+	if(src.format != dst.format)
+		throw std::invalid_argument("ny::copy: formats differ, use blit");
+
+	blit(src, dst, pos, settings);
+}
+
+void blit(const Image& src, const MutableImage& dst, nytl::Vec2ui pos,
+	const ParallelSettings& settings)
+{
+	auto bit = blitBit(src, dst, pos);
+	auto dstStride = bitStride(dst);
+
+	// bands may only run in parallel if the destination rows don't share a byte
+	auto byteRows = bitStride(src) % 8 == 0 && dstStride % 8 == 0;
+	forEachBand(src.size, byteRows, settings, [&](unsigned int begin, unsigned int end) {
+		convertRows(src, dst.format, *dst.data, dstStride, begin, end, bit);
+	});
+}
+
+void composite(const Image& src, const MutableImage& dst, nytl::Vec2ui pos, CompositeOp op,
+	uint8_t alpha)
+{
+	if(!checkComposite(src, dst, pos)) return;
+	compositeRows(src, dst, pos, op, alpha, 0, src.size[1]);
+}
+
+void composite(const Image& src, const MutableImage& dst, nytl::Vec2ui pos, CompositeOp op,
+	uint8_t alpha, const ParallelSettings& settings)
+{
+	if(!checkComposite(src, dst, pos)) return;
+	forEachBand(src.size, true, settings, [&](unsigned int begin, unsigned int end) {
+		compositeRows(src, dst, pos, op, alpha, begin, end);
+	});
+}
+
+void fill(const MutableImage& img, nytl::Vec4u8 color)
+{
+	fillRows(img, {{0u, 0u}, img.size}, color, 0, img.size[1]);
+}
+
+void fillRect(const MutableImage& img, const nytl::Rect2ui& rect, nytl::Vec4u8 color)
+{
+	checkRect(img, rect);
+	fillRows(img, rect, color, 0, rect.size[1]);
+}
+
+void fill(const MutableImage& img, nytl::Vec4u8 color, const ParallelSettings& settings)
 {
-	using Format = ImageFormat;
-	switch(format) {
-		case Format::argb8888:
-		case Format::rgba8888:
-		case Format::abgr8888:
-		case Format::bgra8888:
-			return true;
+	fillRect(img, {{0u, 0u}, img.size}, color, settings);
+}
+
+void fillRect(const MutableImage& img, const nytl::Rect2ui& rect, nytl::Vec4u8 color,
+	const ParallelSettings& settings)
+{
+	checkRect(img, rect);
+	auto byteRows = bitStride(img) % 8 == 0;
+	forEachBand(rect.size, byteRows, settings, [&](unsigned int begin, unsigned int end) {
+		fillRows(img, rect, color, begin, end);
+	});
+}
+
+std::vector<nytl::Rect2ui> diffRegion(const Image& prev, const Image& cur,
+	unsigned int tileSize, unsigned int maxRects)
+{
+	if(prev.format != cur.format || prev.size != cur.size)
+		throw std::invalid_argument("ny::diffRegion: images differ in format or size");
+	if(!tileSize)
+		throw std::invalid_argument("ny::diffRegion: invalid tile size");
+
+	std::vector<nytl::Rect2ui> ret;
+	if(!cur.size[0] || !cur.size[1]) return ret;
+
+	auto tilesX = (cur.size[0] + tileSize - 1) / tileSize;
+	auto tilesY = (cur.size[1] + tileSize - 1) / tileSize;
+	std::vector<uint8_t> dirty(tilesX);
+
+	// indices of the rects in ret that end at the previous tile row, so that
+	// runs with the same horizontal extent can just make them higher
+	std::vector<std::size_t> open, nextOpen;
+	for(auto ty = 0u; ty < tilesY; ++ty) {
+		std::fill(dirty.begin(), dirty.end(), 0u);
+		diffTileRow(prev, cur, tileSize, ty, dirty);
+
+		auto y = ty * tileSize;
+		auto height = std::min(tileSize, cur.size[1] - y);
+		nextOpen.clear();
+		for(auto tx = 0u; tx < tilesX; ++tx) {
+			if(!dirty[tx]) continue;
+
+			auto run = tx;
+			while(tx + 1 < tilesX && dirty[tx + 1]) ++tx;
+
+			auto x = run * tileSize;
+			auto width = std::min((tx + 1) * tileSize, cur.size[0]) - x;
+			auto it = std::find_if(open.begin(), open.end(), [&](std::size_t i) {
+				return ret[i].position[0] == x && ret[i].size[0] == width;
+			});
+
+			if(it != open.end()) {
+				ret[*it].size[1] += height;
+				nextOpen.push_back(*it);
+			} else {
+				nextOpen.push_back(ret.size());
+				ret.push_back({{x, y}, {width, height}});
+			}
+		}
+
+		std::swap(open, nextOpen);
+	}
 
-		case Format::rgb888:
-		case Format::bgr888:
-		case Format::a8:
-		case Format::a1:
-		case Format::none:
-			return false;
+	// too many rects: merge them into their bounding rect
+	if(maxRects && ret.size() > maxRects) {
+		nytl::Vec2ui min = ret.front().position;
+		nytl::Vec2ui max {};
+		for(auto& rect : ret) {
+			for(auto i = 0u; i < 2u; ++i) {
+				min[i] = std::min(min[i], rect.position[i]);
+				max[i] = std::max(max[i], rect.position[i] + rect.size[i]);
+			}
+		}
+
+		ret = {{min, {max[0] - min[0], max[1] - min[1]}}};
 	}
 
-	// should not be reached
-	return false;
+	return ret;
 }
 
-void premultiply(const MutableImage& img, bool resetAlpha)
+LinearImage decodeSrgb(const Image& img)
 {
-	if(!alphaComponent(img.format))
-		return;
+	LinearImage ret;
+	ret.size = img.size;
+	ret.data = std::make_unique<uint16_t[]>(img.size[0] * img.size[1] * 4);
+	decodeSrgb(img, *ret.data.get());
+	return ret;
+}
+
+void decodeSrgb(const Image& img, uint16_t& into)
+{
+	auto bytes = srgbChannels(img);
+	auto size = byteSize(img.format);
+	auto stride = bitStride(img) / 8;
+	auto kernel = &decodeSrgbRow;
+
+	#ifdef NY_IMAGE_X86
+		if(size == 4 && cpuFeatures().avx2) kernel = &decodeSrgbRowAvx2;
+	#endif
 
 	for(auto y = 0u; y < img.size[1]; ++y) {
-		for(auto x = 0u; x < img.size[0]; ++x) {
-			auto color = readPixel(img, {x, y});
-			auto alpha = norm(color, img.format)[3];
-			color[0] *= alpha;
-			color[1] *= alpha;
-			color[2] *= alpha;
-			if(resetAlpha) color[3] = 0;
-			writePixel(img, {x, y}, color);
-		}
+		auto dst = &into + y * img.size[0] * 4;
+		kernel(img.data + y * stride, dst, img.size[0], bytes, size);
 	}
 }
 
+void encodeSrgb(const uint16_t& linear, const MutableImage& img)
+{
+	auto bytes = srgbChannels(img);
+	auto size = byteSize(img.format);
+	auto stride = bitStride(img) / 8;
+	auto kernel = &encodeSrgbRow;
+
+	#ifdef NY_IMAGE_X86
+		if(size == 4 && cpuFeatures().avx2) kernel = &encodeSrgbRowAvx2;
+	#endif
+
+	for(auto y = 0u; y < img.size[1]; ++y) {
+		auto src = &linear + y * img.size[0] * 4;
+		kernel(src, img.data + y * stride, img.size[0], bytes, size);
+	}
+}
+
+void srgbToLinear(const MutableImage& img)
+{
+	auto bytes = srgbChannels(img);
+	auto size = byteSize(img.format);
+	auto stride = bitStride(img) / 8;
+	for(auto y = 0u; y < img.size[1]; ++y)
+		srgbRowInPlace(img.data + y * stride, img.size[0], bytes, size, false);
+}
+
+void linearToSrgb(const MutableImage& img)
+{
+	auto bytes = srgbChannels(img);
+	auto size = byteSize(img.format);
+	auto stride = bitStride(img) / 8;
+	for(auto y = 0u; y < img.size[1]; ++y)
+		srgbRowInPlace(img.data + y * stride, img.size[0], bytes, size, true);
+}
+
+bool alphaComponent(ImageFormat format)
+{
+	auto& info = formatInfo(format);
+	return info.size[3] && (info.size[0] || info.size[1] || info.size[2]);
+}
+
+void premultiply(const MutableImage& img, bool resetAlpha)
+{
+	if(!alphaComponent(img.format)) return;
+	alphaRows(img, false, resetAlpha, 0, img.size[1]);
+}
+
+void premultiply(const MutableImage& img, bool resetAlpha, const ParallelSettings& settings)
+{
+	if(!alphaComponent(img.format)) return;
+
+	auto byteRows = bitStride(img) % 8 == 0;
+	forEachBand(img.size, byteRows, settings, [&](unsigned int begin, unsigned int end) {
+		alphaRows(img, false, resetAlpha, begin, end);
+	});
+}
+
+void unpremultiply(const MutableImage& img)
+{
+	if(!alphaComponent(img.format)) return;
+	alphaRows(img, true, false, 0, img.size[1]);
+}
+
+void unpremultiply(const MutableImage& img, const ParallelSettings& settings)
+{
+	if(!alphaComponent(img.format)) return;
+
+	auto byteRows = bitStride(img) % 8 == 0;
+	forEachBand(img.size, byteRows, settings, [&](unsigned int begin, unsigned int end) {
+		alphaRows(img, true, false, begin, end);
+	});
+}
+
 } // namespace ny
@@ -12,7 +12,11 @@
 
 #include <ny/wayland/protocols/xdg-shell-v5.h>
 #include <ny/wayland/protocols/xdg-shell-v6.h>
+#include <ny/wayland/protocols/viewporter.h>
 
+#include <ny/common/connectionList.hpp>
+#include <ny/common/timer.hpp>
+#include <ny/common/callQueue.hpp>
 #include <ny/loopControl.hpp>
 #include <ny/log.hpp>
 
@@ -38,8 +42,6 @@
 #include <sys/eventfd.h>
 
 #include <algorithm>
-#include <mutex>
-#include <queue>
 #include <cstring>
 #include <sstream>
 #include <atomic>
@@ -67,22 +69,21 @@ namespace {
 
 /// Wayland LoopInterface implementation.
 /// The WaylandAppContext uses a modified version of wl_display_dispatch that
-/// additionally listens for various fds. One of them is an eventfd that is triggered every
-/// time .stop or .call is called to wake the loop up.
+/// additionally listens for various fds. One of them is an eventfd that is triggered
+/// when .stop is called or .call queues the first function since the loop last ran them.
 /// The class has additionally an atomic bool that will be set to false when the
 /// loop was stopped.
 /// The eventfd is only used to wake the polling up, it does not transmit any useful information.
 class WaylandLoopImpl : public ny::LoopInterface {
 public:
 	std::atomic<bool> run {true};
-
 	unsigned int eventfd {};
-	std::queue<std::function<void()>> functions {};
-	std::mutex mutex {};
+	CallQueue functions;
 
 public:
 	WaylandLoopImpl(LoopControl& lc, unsigned int evfd)
 		: LoopInterface(lc), eventfd(evfd) {}
+	~WaylandLoopImpl() { detach(); }
 
 	bool stop() override
 	{
@@ -91,16 +92,9 @@ public:
 		return true;
 	}
 
-	bool call(std::function<void()> function) override
+	bool call(LoopFunction&& function) override
 	{
-		if(!function) return false;
-
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			functions.push(std::move(function));
-		}
-
-		wakeup();
+		if(functions.push(std::move(function))) wakeup();
 		return true;
 	}
 
@@ -110,16 +104,6 @@ public:
 		std::int64_t v = 1;
 		::write(eventfd, &v, 8);
 	}
-
-	// Returns the first queued function to be called or an empty object.
-	std::function<void()> popFunction()
-	{
-		std::lock_guard<std::mutex> lock(mutex);
-		if(functions.empty()) return {};
-		auto ret = std::move(functions.front());
-		functions.pop();
-		return ret;
-	}
 };
 
 // Like poll but does not return on signals.
@@ -171,9 +155,13 @@ struct WaylandAppContext::Impl {
 	wayland::NamedGlobal<wl_seat> wlSeat;
 	wayland::NamedGlobal<xdg_shell> xdgShellV5;
 	wayland::NamedGlobal<zxdg_shell_v6> xdgShellV6;
+	wayland::NamedGlobal<wp_viewporter> wpViewporter;
 
-	// here because ConnectionList is in wayland/util.hpp
 	ConnectionList<ListenerEntry> fdCallbacks;
+	std::unique_ptr<TimerQueue> timers; // created on first use
+
+	// all ShmBuffers are allocated from this pool, created on first use
+	std::unique_ptr<wayland::ShmPool> shmPool;
 
 	// here because changed is const functions (more like cache vars)
 	std::vector<std::unique_ptr<WaylandErrorCategory>> errorCategories;
@@ -283,9 +271,11 @@ WaylandAppContext::~WaylandAppContext()
 
 	clipboardSource_.reset();
 	dndSource_.reset();
+	impl_->shmPool.reset();
 
 	if(xdgShellV5()) xdg_shell_destroy(xdgShellV5());
 	if(xdgShellV6()) zxdg_shell_v6_destroy(xdgShellV6());
+	if(wpViewporter()) wp_viewporter_destroy(wpViewporter());
 
 	if(wlShell()) wl_shell_destroy(wlShell());
 	if(wlSeat()) wl_seat_destroy(wlSeat());
@@ -338,7 +328,7 @@ bool WaylandAppContext::dispatchLoop(LoopControl& control)
 
 	while(loopImpl.run.load()) {
 		// call pending callback & dispatch functions
-		while(auto func = loopImpl.popFunction()) func();
+		loopImpl.functions.run();
 
 		if(dispatchDisplay()) continue;
 		if(!checkErrorWarn()) return false;
@@ -348,6 +338,22 @@ bool WaylandAppContext::dispatchLoop(LoopControl& control)
 	return checkErrorWarn();
 }
 
+nytl::Connection WaylandAppContext::timer(std::chrono::nanoseconds duration,
+	std::function<void()> func, bool repeat)
+{
+	// all timers share one timerfd that is polled like the other fds
+	// no display events have to be read when only the timerfd was triggered
+	if(!impl_->timers) {
+		impl_->timers = std::make_unique<TimerQueue>();
+		fdCallback(impl_->timers->fd(), POLLIN, [&](int, unsigned int){
+			impl_->timers->dispatch();
+			wakeup_ = true;
+		});
+	}
+
+	return impl_->timers->add(duration, std::move(func), repeat);
+}
+
 KeyboardContext* WaylandAppContext::keyboardContext()
 {
 	return waylandKeyboardContext();
@@ -675,13 +681,14 @@ void WaylandAppContext::handleRegistryAdd(wl_registry*, uint32_t id, const char*
 	// the supported interface versions by ny (for stable protocols)
 	// we always select the minimum between version supported by ny and version
 	// supported by the compositor
-	static constexpr auto compositorVersion = 1u;
+	static constexpr auto compositorVersion = 4u;
 	static constexpr auto shellVersion = 1u;
 	static constexpr auto shmVersion = 1u;
 	static constexpr auto subcompositorVersion = 1u;
 	static constexpr auto outputVersion = 2u;
 	static constexpr auto dataDeviceManagerVersion = 3u;
 	static constexpr auto seatVersion = 5u;
+	static constexpr auto viewporterVersion = 1u;
 
 	const nytl::StringParam interface = cinterface; // equal comparison using ==
 	// debug("ny::WaylandAppContext::handleRegistryAdd: interface ", interface);
@@ -718,6 +725,10 @@ void WaylandAppContext::handleRegistryAdd(wl_registry*, uint32_t id, const char*
 		auto ptr = wl_registry_bind(&wlRegistry(), id, &wl_seat_interface, usedVersion);
 		impl_->wlSeat = {static_cast<wl_seat*>(ptr), id};
 		wl_seat_add_listener(wlSeat(), &seatListener, this);
+	} else if(interface == "wp_viewporter" && !impl_->wpViewporter) {
+		auto usedVersion = std::min(version, viewporterVersion);
+		auto ptr = wl_registry_bind(&wlRegistry(), id, &wp_viewporter_interface, usedVersion);
+		impl_->wpViewporter = {static_cast<wp_viewporter*>(ptr), id};
 	}
 
 	// for unstable protocols, we only bind for the ny-implemented version
@@ -816,6 +827,16 @@ wl_keyboard* WaylandAppContext::wlKeyboard() const
 	return waylandKeyboardContext()->wlKeyboard();
 }
 
+wayland::ShmPool& WaylandAppContext::shmPool() const
+{
+	if(!impl_->shmPool) {
+		if(!wlShm()) throw std::runtime_error("ny::WaylandAppContext::shmPool: no wl_shm");
+		impl_->shmPool = std::make_unique<wayland::ShmPool>(*wlShm());
+	}
+
+	return *impl_->shmPool;
+}
+
 // getters
 wl_display& WaylandAppContext::wlDisplay() const { return *wlDisplay_; }
 wl_registry& WaylandAppContext::wlRegistry() const { return *wlRegistry_; }
@@ -826,6 +847,7 @@ wl_seat* WaylandAppContext::wlSeat() const { return impl_->wlSeat; }
 wl_shell* WaylandAppContext::wlShell() const { return impl_->wlShell; }
 xdg_shell* WaylandAppContext::xdgShellV5() const { return impl_->xdgShellV5; }
 zxdg_shell_v6* WaylandAppContext::xdgShellV6() const { return impl_->xdgShellV6; }
+wp_viewporter* WaylandAppContext::wpViewporter() const { return impl_->wpViewporter; }
 wl_data_device_manager* WaylandAppContext::wlDataManager() const { return impl_->wlDataManager; }
 wl_cursor_theme* WaylandAppContext::wlCursorTheme() const { return wlCursorTheme_; }
 
@@ -3,22 +3,52 @@
 // See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
 
 #include <ny/wayland/bufferSurface.hpp>
+#include <ny/wayland/appContext.hpp>
 #include <ny/wayland/util.hpp>
+#include <ny/wayland/protocols/viewporter.h>
 #include <ny/log.hpp>
 #include <ny/surface.hpp>
 
+#include <wayland-client-protocol.h>
+
 #include <stdexcept> // std::runtime_error
+#include <algorithm> // std::min
+#include <cmath> // std::lround
 
 namespace ny {
 
 // WaylandBufferSurface
-WaylandBufferSurface::WaylandBufferSurface(WaylandWindowContext& wc) : windowContext_(&wc)
+WaylandBufferSurface::WaylandBufferSurface(WaylandWindowContext& wc,
+	const BufferSurfaceSettings& settings) : windowContext_(&wc)
 {
+	count_ = settings.bufferCount ? settings.bufferCount : defaultBufferCount;
+	count_ = std::max(std::min(count_, maxBufferCount), minBufferCount);
+	preserve_ = settings.preserveContents;
+
+	// argb8888 and xrgb8888 are always supported
+	// for opaque windows xrgb is used so the compositor does not have to blend
+	auto format = imageFormatToWayland(settings.format);
+	if(format != -1 && wc.appContext().shmFormatSupported(format)) format_ = format;
+	else format_ = WL_SHM_FORMAT_ARGB8888;
+
+	if(wc.opaque() && format_ == WL_SHM_FORMAT_ARGB8888) format_ = WL_SHM_FORMAT_XRGB8888;
+
+	queue_ = wl_display_create_queue(&wc.wlDisplay());
+
+	if(settings.scale != 1.f && !renderScale(settings.scale)) {
+		ny_warn("::WlBufferSurface"_src, "wp_viewporter not supported, ignoring scale");
+	}
 }
 
 WaylandBufferSurface::~WaylandBufferSurface()
 {
 	if(active_) ny_warn("~WlBufferSurface"_scope, "there is still an active BufferGuard");
+
+	if(viewport_) wp_viewport_destroy(viewport_);
+
+	// the buffers must be destroyed before the queue they use
+	for(auto& b : buffers_) b = {};
+	if(queue_) wl_event_queue_destroy(queue_);
 }
 
 BufferGuard WaylandBufferSurface::buffer()
@@ -26,26 +56,114 @@ BufferGuard WaylandBufferSurface::buffer()
 	if(active_)
 		throw std::logic_error("ny::WlBufferSurface: there is already an active BufferGuard");
 
-	auto size = windowContext().size();
-	for(auto& b : buffers_) {
-		if(b.used()) continue;
-		if(b.size() != size) b.size(size);
+	// wait until the compositor releases one of the buffers
+	// only the release events of our buffers are dispatched on queue_
+	auto& display = windowContext().wlDisplay();
+	wl_display_dispatch_queue_pending(&display, queue_);
+
+	auto* buffer = unused();
+	while(!buffer) {
+		if(wl_display_dispatch_queue(&display, queue_) == -1)
+			throw std::runtime_error("ny::WlBufferSurface: failed to dispatch display");
+		buffer = unused();
+	}
+
+	// the contents of new or resized buffers are undefined
+	auto windowSize = windowContext().size();
+	auto size = windowSize;
+	if(scale_ != 1.f) {
+		size[0] = std::max(std::lround(windowSize[0] * scale_), 1l);
+		size[1] = std::max(std::lround(windowSize[1] * scale_), 1l);
+	}
 
-		b.use();
-		active_ = &b;
-		auto format = waylandToImageFormat(b.format());
-		return {*this, {&b.data(), size, format, b.stride() * 8}};
+	auto& presented = presented_[buffer - buffers_.data()];
+	if(!buffer->valid()) {
+		*buffer = {windowContext().appContext(), size, 0u, format_};
+		buffer->queue(queue_);
+		presented = 0u;
+	} else if(buffer->size() != size) {
+		buffer->size(size);
+		presented = 0u;
 	}
 
-	// create new buffer if none is unused
-	buffers_.emplace_back(windowContext().appContext(), size);
-	buffers_.back().use();
-	active_ = &buffers_.back();
-	auto format = waylandToImageFormat(buffers_.back().format());
+	auto format = waylandToImageFormat(buffer->format());
 	if(format == ImageFormat::none)
 		throw std::runtime_error("ny::WlBufferSurface: failed to parse shm buffer format");
 
-	return {*this, {&buffers_.back().data(), size, format, buffers_.back().stride() * 8}};
+	auto age = presented ? frame_ - presented + 1 : 0u;
+	if(preserve_ && age != 1) age = preserve(*buffer, age);
+
+	buffer->use();
+	active_ = buffer;
+	windowSize_ = windowSize;
+	return {*this, {&buffer->data(), size, format, buffer->stride() * 8}, age, windowSize};
+}
+
+bool WaylandBufferSurface::renderScale(float scale)
+{
+	if(!BufferSurface::renderScale(scale) && !windowContext().appContext().wpViewporter())
+		return false;
+
+	scale_ = scale;
+	return true;
+}
+
+std::vector<ImageFormat> WaylandBufferSurface::formats() const
+{
+	// buffer() only provides buffers in format_, even if the compositor
+	// supports other shm formats as well
+	return {waylandToImageFormat(format_)};
+}
+
+bool WaylandBufferSurface::available()
+{
+	wl_display_dispatch_queue_pending(&windowContext().wlDisplay(), queue_);
+	return unused() != nullptr;
+}
+
+wayland::ShmBuffer* WaylandBufferSurface::unused()
+{
+	wayland::ShmBuffer* uncreated = nullptr;
+	for(auto i = 0u; i < count_; ++i) {
+		auto& b = buffers_[i];
+		if(!b.valid() && !uncreated) uncreated = &b;
+		else if(b.valid() && !b.used()) return &b;
+	}
+
+	return uncreated;
+}
+
+unsigned int WaylandBufferSurface::preserve(wayland::ShmBuffer& buffer, unsigned int age)
+{
+	// the last presented buffer is already up to date. If there is nothing to
+	// copy from, the age must be 0 since apps in preserve mode only redraw the
+	// damage of the current frame.
+	if(last_ == &buffer) return std::min(age, 1u);
+	if(!last_ || last_->size() != buffer.size()) return 0u;
+
+	auto format = waylandToImageFormat(buffer.format());
+	Image src {&last_->data(), last_->size(), format, last_->stride() * 8};
+	MutableImage dst {&buffer.data(), buffer.size(), format, buffer.stride() * 8};
+
+	// the buffer is missing the changes from the last (age - 1) frames
+	// if they are not known anymore, just copy everything
+	if(!age || age - 1 > maxBufferCount) {
+		copy(src, dst);
+		return 1u;
+	}
+
+	// damage of frames with another size has to be clipped
+	auto size = buffer.size();
+	for(auto f = frame_ - (age - 2); f <= frame_; ++f) {
+		for(auto rect : damage_[f % maxBufferCount]) {
+			if(rect.position[0] >= size[0] || rect.position[1] >= size[1]) continue;
+			rect.size[0] = std::min(rect.size[0], size[0] - rect.position[0]);
+			rect.size[1] = std::min(rect.size[1], size[1] - rect.position[1]);
+			copy(subImage(src, rect), dst, rect.position);
+		}
+	}
+
+	return 1u;
 }
 
 void WaylandBufferSurface::apply(const BufferGuard& buffer) noexcept
@@ -55,7 +173,37 @@ void WaylandBufferSurface::apply(const BufferGuard& buffer) noexcept
 		return;
 	}
 
-	windowContext().attachCommit(&active_->wlBuffer());
+	// let the compositor scale the buffer to the window size if it is scaled
+	auto& wc = windowContext();
+	auto scaled = active_->size() != windowSize_;
+	if(scaled && !viewport_) {
+		viewport_ = wp_viewporter_get_viewport(wc.appContext().wpViewporter(), &wc.wlSurface());
+	}
+
+	if(scaled && destination_ != windowSize_) {
+		wp_viewport_set_destination(viewport_, windowSize_[0], windowSize_[1]);
+		destination_ = windowSize_;
+	} else if(!scaled && destination_ != nytl::Vec2ui {}) {
+		wp_viewport_set_destination(viewport_, -1, -1);
+		destination_ = {};
+	}
+
+	// without damage_buffer, damage is given in surface coordinates which
+	// differ from the buffer coordinates when scaled, so damage everything
+	auto damageBuffer = wl_surface_get_version(&wc.wlSurface()) >=
+		WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+	if(buffer.fullDamage() || (scaled && !damageBuffer))
+		windowContext().attachCommit(&active_->wlBuffer());
+	else windowContext().attachCommit(&active_->wlBuffer(), buffer.damage());
+
+	// remember the damage of this frame for preserving the contents
+	++frame_;
+	presented_[active_ - buffers_.data()] = frame_;
+	auto& damage = damage_[frame_ % maxBufferCount];
+	if(buffer.fullDamage()) damage = {{{0u, 0u}, active_->size()}};
+	else damage = buffer.damage();
+
+	last_ = active_;
 	active_ = nullptr;
 }
 
@@ -63,7 +211,7 @@ void WaylandBufferSurface::apply(const BufferGuard& buffer) noexcept
 WaylandBufferWindowContext::WaylandBufferWindowContext(WaylandAppContext& ac,
 	const WaylandWindowSettings& settings) :
 		WaylandWindowContext(ac, settings),
-		bufferSurface_(*this)
+		bufferSurface_(*this, settings.buffer)
 {
 	if(settings.buffer.storeSurface) *settings.buffer.storeSurface = &bufferSurface_;
 }
@@ -103,6 +103,7 @@ void WaylandMouseContext::handleEnter(wl_pointer*, uint32_t serial, wl_surface*
 			mce.entered = true;
 			mce.position = pos;
 			wc->listener().mouseCross(mce);
+			wc->useCursorBuffer();
 			cursorBuffer(wc->wlCursorBuffer(), wc->cursorHotspot(), wc->cursorSize());
 		}
 
@@ -22,6 +22,8 @@
 #include <string.h>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+#include <limits>
 
 namespace ny {
 namespace wayland {
@@ -99,12 +101,145 @@ int osCreateAnonymousFile(off_t size)
 
 } // anonymous util namespace
 
-//shmBuffer
-ShmBuffer::ShmBuffer(WaylandAppContext& ac, nytl::Vec2ui size, unsigned int stride)
-	: appContext_(&ac), size_(size), stride_(stride)
+// ShmPool
+ShmPool::ShmPool(wl_shm& shm, unsigned int size)
 {
-	format_ = WL_SHM_FORMAT_ARGB8888;
-	if(!stride_) stride_ = size[0] * 4;
+	size = std::max(size, alignment);
+	size = ((size + alignment - 1) / alignment) * alignment;
+
+	// memfd does not need a file in XDG_RUNTIME_DIR
+#ifdef MFD_CLOEXEC
+	fd_ = memfd_create("ny-wayland-shm", MFD_CLOEXEC);
+	if(fd_ != -1 && ftruncate(fd_, size) != 0) {
+		close(fd_);
+		fd_ = -1;
+	}
+#endif // MFD_CLOEXEC
+
+	if(fd_ == -1) fd_ = osCreateAnonymousFile(size);
+	if(fd_ == -1) throw std::runtime_error("ny::wayland::ShmPool: could not create shm file");
+
+	// reserve an address range for the file to grow into, mapping beyond
+	// the end of the file is allowed (only accessing it is not).
+	// wl_shm_pool sizes are int32_t anyways
+	reserved_ = sizeof(void*) >= 8 ? (1ull << 30) : (1ull << 28);
+	reserved_ = std::max<std::size_t>(reserved_, size);
+
+	auto ptr = mmap(nullptr, reserved_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if(ptr == MAP_FAILED) {
+		close(fd_);
+		throw std::runtime_error("ny::wayland::ShmPool: could not mmap file");
+	}
+
+	data_ = reinterpret_cast<std::uint8_t*>(ptr);
+	size_ = size;
+	pool_ = wl_shm_create_pool(&shm, fd_, size_);
+	free_.push_back({0u, size_});
+}
+
+ShmPool::~ShmPool()
+{
+	pending_.clear();
+	if(pool_) wl_shm_pool_destroy(pool_);
+	if(data_) munmap(data_, reserved_);
+	if(fd_ != -1) close(fd_);
+}
+
+ShmPool::Range ShmPool::allocate(unsigned int size)
+{
+	if(!size) throw std::runtime_error("ny::wayland::ShmPool::allocate: invalid size");
+	size = ((size + alignment - 1) / alignment) * alignment;
+
+	auto fit = [&]{
+		return std::find_if(free_.begin(), free_.end(),
+			[&](const Range& r){ return r.size >= size; });
+	};
+
+	auto it = fit();
+	if(it == free_.end()) {
+		// the last free range can be extended if it reaches the end of the pool
+		auto needed = size;
+		if(!free_.empty() && free_.back().offset + free_.back().size == size_)
+			needed -= free_.back().size;
+
+		// grow exponentially but never beyond what can be mapped, only fail
+		// if the needed size does not fit
+		std::size_t limit = std::numeric_limits<int32_t>::max();
+		limit = (std::min(limit, reserved_) / alignment) * alignment;
+		if(std::size_t(size_) + needed > limit)
+			throw std::runtime_error("ny::wayland::ShmPool: exceeded maximum pool size");
+
+		auto newSize = std::max(std::size_t(size_) * 2, std::size_t(size_) + needed);
+		grow(static_cast<unsigned int>(std::min(newSize, limit)));
+		it = fit();
+	}
+
+	Range ret {it->offset, size};
+	it->offset += size;
+	it->size -= size;
+	if(!it->size) free_.erase(it);
+
+	return ret;
+}
+
+void ShmPool::free(const Range& range)
+{
+	if(!range.size) return;
+
+	auto it = std::lower_bound(free_.begin(), free_.end(), range.offset,
+		[](const Range& r, unsigned int offset){ return r.offset < offset; });
+	it = free_.insert(it, range);
+
+	// merge with the following and the previous range
+	auto next = it + 1;
+	if(next != free_.end() && it->offset + it->size == next->offset) {
+		it->size += next->size;
+		free_.erase(next);
+	}
+
+	if(it != free_.begin()) {
+		auto prev = it - 1;
+		if(prev->offset + prev->size == it->offset) {
+			prev->size += it->size;
+			free_.erase(it);
+		}
+	}
+}
+
+void ShmPool::keepUntilReleased(std::unique_ptr<ShmBuffer> buffer)
+{
+	pending_.push_back(std::move(buffer));
+}
+
+void ShmPool::released(const ShmBuffer& buffer)
+{
+	auto it = std::find_if(pending_.begin(), pending_.end(),
+		[&](const auto& pending){ return pending.get() == &buffer; });
+	if(it != pending_.end()) pending_.erase(it);
+}
+
+void ShmPool::grow(unsigned int size)
+{
+	auto maxSize = static_cast<unsigned int>(std::numeric_limits<int32_t>::max());
+	if(size > reserved_ || size > maxSize)
+		throw std::runtime_error("ny::wayland::ShmPool: exceeded maximum pool size");
+
+	if(ftruncate(fd_, size) != 0)
+		throw std::runtime_error("ny::wayland::ShmPool: could not resize shm file");
+
+	wl_shm_pool_resize(pool_, size);
+	free(Range{size_, size - size_});
+	size_ = size;
+}
+
+// ShmBuffer
+ShmBuffer::ShmBuffer(WaylandAppContext& ac, nytl::Vec2ui size, unsigned int stride,
+	unsigned int format) : appContext_(&ac), size_(size), stride_(stride), format_(format)
+{
+	if(waylandToImageFormat(format_) == ImageFormat::none)
+		throw std::runtime_error("ny::wayland::ShmBuffer: unsupported format");
+
+	if(!stride_) stride_ = size[0] * byteSize(waylandToImageFormat(format_));
 	create();
 }
 
@@ -116,21 +251,21 @@ ShmBuffer::~ShmBuffer()
 ShmBuffer::ShmBuffer(ShmBuffer&& other)
 {
 	appContext_ = other.appContext_;
-	shmSize_ = other.shmSize_;
+	pool_ = other.pool_;
+	range_ = other.range_;
 	size_ = other.size_;
 	stride_ = other.stride_;
 	buffer_ = other.buffer_;
-	pool_ = other.pool_;
-	data_ = other.data_;
+	queue_ = other.queue_;
 	format_ = other.format_;
 	used_ = other.used_;
 
 	other.appContext_ = {};
-	other.shmSize_ = {};
+	other.pool_ = {};
+	other.range_ = {};
 	other.size_ = {};
 	other.buffer_ = {};
-	other.pool_ = {};
-	other.data_ = {};
+	other.queue_ = {};
 	other.format_ = {};
 	other.used_ = {};
 
@@ -142,21 +277,21 @@ ShmBuffer& ShmBuffer::operator=(ShmBuffer&& other)
 	destroy();
 
 	appContext_ = other.appContext_;
-	shmSize_ = other.shmSize_;
+	pool_ = other.pool_;
+	range_ = other.range_;
 	size_ = other.size_;
 	stride_ = other.stride_;
 	buffer_ = other.buffer_;
-	pool_ = other.pool_;
-	data_ = other.data_;
+	queue_ = other.queue_;
 	format_ = other.format_;
 	used_ = other.used_;
 
 	other.appContext_ = {};
-	other.shmSize_ = {};
+	other.pool_ = {};
+	other.range_ = {};
 	other.size_ = {};
 	other.buffer_ = {};
-	other.pool_ = {};
-	other.data_ = {};
+	other.queue_ = {};
 	other.format_ = {};
 	other.used_ = {};
 
@@ -171,59 +306,87 @@ void ShmBuffer::create()
 	if(!size_[0] || !size_[1]) throw std::runtime_error("ny::wayland::ShmBuffer invalid size");
 	if(!stride_) throw std::runtime_error("ny::wayland::ShmBuffer invalid stride");
 
-	auto* shm = appContext_->wlShm();
-	if(!shm) throw std::runtime_error("ny::wayland::ShmBuffer: appContext has no wl_shm");
-
-	auto vecSize = stride_ * size_[1];
-	shmSize_ = std::max(vecSize, shmSize_);
-
-	auto fd = osCreateAnonymousFile(shmSize_);
-	if (fd < 0) throw std::runtime_error("ny::wayland::ShmBuffer: could not create shm file");
-
-	// the fd is not needed here anymore AFTER the pool was created
-	// our access to the file is represented by the pool
-	auto fdGuard = nytl::makeScopeGuard([&]{ close(fd); });
-
-	auto ptr = mmap(nullptr, shmSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if(ptr == MAP_FAILED) throw std::runtime_error("ny::wayland::ShmBuffer: could not mmap file");
+	pool_ = &appContext_->shmPool();
+	range_ = pool_->allocate(dataSize());
+	createBuffer();
+}
 
-	data_ = reinterpret_cast<std::uint8_t*>(ptr);
-	pool_ = wl_shm_create_pool(shm, fd, shmSize_);
-	buffer_ = wl_shm_pool_create_buffer(pool_, 0, size_[0], size_[1], stride_, format_);
+void ShmBuffer::createBuffer()
+{
+	buffer_ = wl_shm_pool_create_buffer(&pool_->wlShmPool(), range_.offset,
+		size_[0], size_[1], stride_, format_);
 
 	static constexpr wl_buffer_listener listener {
 		memberCallback<decltype(&ShmBuffer::released), &ShmBuffer::released>
 	};
 
 	wl_buffer_add_listener(buffer_, &listener, this);
+	if(queue_) wl_proxy_set_queue(reinterpret_cast<wl_proxy*>(buffer_), queue_);
+}
+
+void ShmBuffer::queue(wl_event_queue* queue)
+{
+	queue_ = queue;
+	if(buffer_) wl_proxy_set_queue(reinterpret_cast<wl_proxy*>(buffer_), queue_);
 }
 
 void ShmBuffer::destroy()
 {
+	// the storage of a buffer must not be reused before the compositor
+	// released it, so the pool keeps such buffers until then.
+	// Their release events are dispatched on the default queue since our
+	// queue might be destroyed before.
+	if(buffer_ && used_ && !pending_) {
+		auto pending = std::make_unique<ShmBuffer>();
+		pending->pool_ = pool_;
+		pending->range_ = range_;
+		pending->buffer_ = buffer_;
+		pending->used_ = true;
+		pending->pending_ = true;
+
+		wl_buffer_set_user_data(buffer_, pending.get());
+		wl_proxy_set_queue(reinterpret_cast<wl_proxy*>(buffer_), nullptr);
+		pool_->keepUntilReleased(std::move(pending));
+
+		buffer_ = {};
+		range_ = {};
+		used_ = false;
+		return;
+	}
+
 	if(buffer_) wl_buffer_destroy(buffer_);
-	if(pool_) wl_shm_pool_destroy(pool_);
-	if(data_) munmap(data_, shmSize_);
+	if(pool_) pool_->free(range_);
+
+	buffer_ = {};
+	range_ = {};
+}
+
+void ShmBuffer::released(wl_buffer*)
+{
+	used_ = false;
+	if(pending_) pool_->released(*this); // destroys this
 }
 
 bool ShmBuffer::size(nytl::Vec2ui size, unsigned int stride)
 {
+	if(!stride) stride = size[0] * byteSize(waylandToImageFormat(format_));
+	if(!size[0] || !size[1]) throw std::runtime_error("ny::wayland::ShmBuffer invalid size");
+	if(!stride) throw std::runtime_error("ny::wayland::ShmBuffer invalid stride");
+	if(buffer_ && size == size_ && stride == stride_) return false;
+
 	size_ = size;
 	stride_ = stride;
 
-	if(!stride_) stride_ = size[0] * 4;
-	unsigned int vecSize = stride_ * size_[1];
-
-	if(!size_[0] || !size_[1]) throw std::runtime_error("ny::wayland::ShmBuffer invalid size");
-	if(!stride_) throw std::runtime_error("ny::wayland::ShmBuffer invalid stride");
-
-	if(vecSize > shmSize_) {
+	// the range of a buffer the compositor still uses can't be reused
+	if(dataSize() > range_.size || used_) {
 		create();
 		return true;
-	} else {
-		wl_buffer_destroy(buffer_);
-		buffer_ = wl_shm_pool_create_buffer(pool_, 0, size_[0], size_[1], stride_, format_);
-		return false;
 	}
+
+	// the wl_buffer has a fixed size, but the range can be reused
+	wl_buffer_destroy(buffer_);
+	createBuffer();
+	return false;
 }
 
 // Output
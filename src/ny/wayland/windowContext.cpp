@@ -21,6 +21,7 @@
 
 #include <iostream>
 #include <cstring>
+#include <limits>
 
 // TODO: correct xdg surface configure/ sizing, better subsurface support
 // TODO: implement show capability? could be done with custom egl surface, show flag
@@ -34,6 +35,7 @@ WaylandWindowContext::WaylandWindowContext(WaylandAppContext& ac,
 	// parse settings
 	size_ = settings.size;
 	if(size_ == defaultSize) size_ = fallbackSize;
+	opaque_ = settings.opaque;
 	if(settings.listener) listener(*settings.listener);
 
 	// surface
@@ -51,6 +53,8 @@ WaylandWindowContext::WaylandWindowContext(WaylandAppContext& ac,
 		wl_surface_set_user_data(wlSurface_, this);
 	}
 
+	updateOpaqueRegion();
+
 	if(settings.parent.pointer()) {
 		auto& parent = *reinterpret_cast<wl_surface*>(settings.parent.pointer());
 		createSubsurface(parent, settings);
@@ -176,6 +180,7 @@ void WaylandWindowContext::createXdgSurfaceV6(const WaylandWindowSettings& ws)
 	// wants the application to choose the size we need this call to actually choose it.
 	// how to handle this? somehow parse the configure events we get and react to it
 	zxdg_surface_v6_set_window_geometry(xdgSurfaceV6_.surface, 0, 0, size()[0], size()[1]);
+	updateOpaqueRegion();
 
 	zxdg_surface_v6_add_listener(xdgSurfaceV6_.surface, &xdgSurfaceListener, this);
 	zxdg_toplevel_v6_add_listener(xdgSurfaceV6_.toplevel, &xdgToplevelListener, this);
@@ -290,9 +295,21 @@ void WaylandWindowContext::hide()
 void WaylandWindowContext::size(nytl::Vec2ui size)
 {
 	size_ = size;
+	updateOpaqueRegion();
 	refresh();
 }
 
+void WaylandWindowContext::updateOpaqueRegion()
+{
+	if(!opaque_) return;
+
+	// the region is copied by the compositor, so it can be destroyed directly
+	auto region = wl_compositor_create_region(&appContext().wlCompositor());
+	wl_region_add(region, 0, 0, size_[0], size_[1]);
+	wl_surface_set_opaque_region(wlSurface_, region);
+	wl_region_destroy(region);
+}
+
 void WaylandWindowContext::position(nytl::Vec2i position)
 {
 	// TODO: support xdg v6 positioner
@@ -351,8 +368,17 @@ void WaylandWindowContext::cursor(const Cursor& cursor)
 	}
 
 	// update the cursor if needed
-	if(wmc->over() == this)
+	if(wmc->over() == this) {
+		useCursorBuffer();
 		wmc->cursorBuffer(cursorBuffer_, cursorHotspot_, cursorSize_);
+	}
+}
+
+void WaylandWindowContext::useCursorBuffer()
+{
+	// the storage of the image cursor must not be reused before it is released
+	if(shmCursorBuffer_.valid() && cursorBuffer_ == &shmCursorBuffer_.wlBuffer())
+		shmCursorBuffer_.use();
 }
 
 void WaylandWindowContext::minSize(nytl::Vec2ui size)
@@ -544,6 +570,17 @@ wl_display& WaylandWindowContext::wlDisplay() const
 }
 
 void WaylandWindowContext::attachCommit(wl_buffer* buffer)
+{
+	// the buffer might be larger than the window (e.g. with a render scale), so
+	// damage the maximum extents. The compositor clips them, in surface as well
+	// as in buffer coordinates
+	auto max = static_cast<unsigned int>(std::numeric_limits<int32_t>::max());
+	nytl::Rect2ui full {{0u, 0u}, {max, max}};
+	attachCommit(buffer, {&full, 1});
+}
+
+void WaylandWindowContext::attachCommit(wl_buffer* buffer,
+	nytl::Span<const nytl::Rect2ui> damage)
 {
 	using WWC = WaylandWindowContext;
 	static constexpr wl_callback_listener frameListener {
@@ -552,9 +589,22 @@ void WaylandWindowContext::attachCommit(wl_buffer* buffer)
 
 	frameCallback_ = wl_surface_frame(wlSurface_);
 	wl_callback_add_listener(frameCallback_, &frameListener, this);
-	wl_surface_damage(wlSurface_, 0, 0, size_[0], size_[1]);
-	wl_surface_attach(wlSurface_, buffer, 0, 0);
 
+	// damage_buffer (since wl_surface v4) takes buffer coordinates which makes it
+	// independent from any buffer scale or transform
+	auto version = wl_surface_get_version(wlSurface_);
+	auto damageBuffer = version >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+	for(auto& rect : damage) {
+		if(damageBuffer) {
+			wl_surface_damage_buffer(wlSurface_, rect.position[0], rect.position[1],
+				rect.size[0], rect.size[1]);
+		} else {
+			wl_surface_damage(wlSurface_, rect.position[0], rect.position[1],
+				rect.size[0], rect.size[1]);
+		}
+	}
+
+	wl_surface_attach(wlSurface_, buffer, 0, 0);
 	wl_surface_commit(wlSurface_);
 }
 
@@ -660,6 +710,9 @@ void WaylandWindowContext::handleXdgSurfaceV6Configure(zxdg_surface_v6*, uint32_
 	zxdg_surface_v6_ack_configure(xdgSurfaceV6(), serial);
 	zxdg_surface_v6_set_window_geometry(xdgSurfaceV6_.surface, 0, 0, size()[0], size()[1]);
 
+	// size_ was already changed by the toplevel configure event
+	updateOpaqueRegion();
+
 	SizeEvent se;
 	se.size = size_;
 	listener().resize(se);
@@ -48,7 +48,7 @@ public:
 	DWORD threadHandle;
 
 	std::atomic<bool> run {true};
-	std::queue<std::function<void()>> functions;
+	std::queue<LoopFunction> functions;
 	std::mutex mutex;
 
 public:
@@ -57,6 +57,8 @@ public:
 		threadHandle = ::GetCurrentThreadId();
 	}
 
+	~WinapiLoopImpl() { detach(); }
+
 	bool stop() override
 	{
 		run.store(false);
@@ -64,7 +66,7 @@ public:
 		return true;
 	};
 
-	bool call(std::function<void()> function) override
+	bool call(LoopFunction&& function) override
 	{
 		if(!function) return false;
 
@@ -82,7 +84,7 @@ public:
 		::PostThreadMessage(threadHandle, WM_USER, 0, 0);
 	}
 
-	std::function<void()> popFunction()
+	LoopFunction popFunction()
 	{
 		std::lock_guard<std::mutex> lock(mutex);
 		if(functions.empty()) return {};
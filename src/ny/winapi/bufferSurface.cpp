@@ -48,7 +48,15 @@ void WinapiBufferSurface::apply(const BufferGuard& bufferGuard) noexcept
 	auto bhdc = ::CreateCompatibleDC(whdc);
 
 	auto prev = ::SelectObject(bhdc, bitmap);
-	::BitBlt(whdc, 0, 0, size_[0], size_[1], bhdc, 0, 0, SRCCOPY);
+	if(bufferGuard.fullDamage()) {
+		::BitBlt(whdc, 0, 0, size_[0], size_[1], bhdc, 0, 0, SRCCOPY);
+	} else {
+		for(auto& rect : bufferGuard.damage()) {
+			auto x = rect.position[0];
+			auto y = rect.position[1];
+			::BitBlt(whdc, x, y, rect.size[0], rect.size[1], bhdc, x, y, SRCCOPY);
+		}
+	}
 	::SelectObject(bhdc, prev);
 
 	::DeleteDC(bhdc);
@@ -10,6 +10,9 @@
 #include <ny/x11/dataExchange.hpp>
 
 #include <ny/common/unix.hpp>
+#include <ny/common/connectionList.hpp>
+#include <ny/common/timer.hpp>
+#include <ny/common/callQueue.hpp>
 #include <ny/loopControl.hpp>
 #include <ny/log.hpp>
 #include <ny/dataExchange.hpp>
@@ -37,35 +40,36 @@
 
 #include <xcb/xcb.h>
 #include <xcb/xcb_ewmh.h>
+#include <xcb/present.h>
+#include <xcb/shm.h>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include <cstring>
-#include <mutex>
+#include <cerrno>
+#include <algorithm>
 #include <atomic>
-#include <queue>
 
 namespace ny {
 namespace {
 
-// TODO: reimplement this using eventfd and allow X11AppContext to handle fd callbacks
-// should be more efficient and offer more possibilities
-// See WaylandAppContexst for details
-// See also the common unix AppContext interface concept
-
 /// X11 LoopInterface implementation.
-/// Wakes up a blocking xcb_connection by simply sending a client message to
-/// a dummy window.
+/// Wakes up the polling dispatch loop by writing to an eventfd, so that calls
+/// from other threads don't cause any traffic to the server.
+/// Functions are queued in a CallQueue, the eventfd is only written when the
+/// loop might not know about the queued functions yet.
 class X11LoopImpl : public ny::LoopInterface {
 public:
-	xcb_connection_t& xConnection;
-	xcb_window_t xDummyWindow {};
-
+	int eventfd {};
 	std::atomic<bool> run {true};
-	std::queue<std::function<void()>> functions;
-	std::mutex mutex;
+	CallQueue functions;
 
 public:
-	X11LoopImpl(LoopControl& control, xcb_connection_t& conn, xcb_window_t win)
-		:  LoopInterface(control), xConnection(conn), xDummyWindow(win) {}
+	X11LoopImpl(LoopControl& control, int evfd)
+		:  LoopInterface(control), eventfd(evfd) {}
+	~X11LoopImpl() { detach(); }
 
 	bool stop() override
 	{
@@ -74,39 +78,34 @@ public:
 		return true;
 	}
 
-	bool call(std::function<void()> function) override
+	bool call(LoopFunction&& function) override
 	{
-		if(!function) return false;
-
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			functions.push(std::move(function));
-		}
-
-		wakeup();
+		if(functions.push(std::move(function))) wakeup();
 		return true;
 	}
 
+	// Write to the eventfd to wake a potential loop polling up.
 	void wakeup()
 	{
-		xcb_client_message_event_t dummyEvent {};
-		dummyEvent.window = xDummyWindow;
-		dummyEvent.response_type = XCB_CLIENT_MESSAGE;
-		dummyEvent.format = 32;
-
-		auto eventData = reinterpret_cast<const char*>(&dummyEvent);
-		xcb_send_event(&xConnection, 0, xDummyWindow, 0, eventData);
-		xcb_flush(&xConnection);
+		std::int64_t v = 1;
+		::write(eventfd, &v, 8);
 	}
+};
 
-	std::function<void()> popFunction()
-	{
-		std::lock_guard<std::mutex> lock(mutex);
-		if(functions.empty()) return {};
-		auto ret = std::move(functions.front());
-		functions.pop();
-		return ret;
+// Like poll but does not return on signals.
+int noSigPoll(pollfd& fds, nfds_t nfds, int timeout = -1)
+{
+	while(true) {
+		auto ret = poll(&fds, nfds, timeout);
+		if(ret != -1 || errno != EINTR) return ret;
 	}
+}
+
+// Listener entry to implement custom fd polling callbacks in X11AppContext.
+struct ListenerEntry {
+	int fd {};
+	unsigned int events {};
+	std::function<void(nytl::Connection, int fd, unsigned int events)> callback;
 };
 
 } // anonymous util namespace
@@ -116,6 +115,10 @@ struct X11AppContext::Impl {
 	x11::Atoms atoms;
 	X11ErrorCategory errorCategory;
 	X11DataManager dataManager;
+	unsigned int presentOpcode {}; // major opcode of the present extension, 0 if not supported
+	unsigned int shmEventBase {}; // first event of the shm extension, 0 if not supported
+	ConnectionList<ListenerEntry> fdCallbacks;
+	std::unique_ptr<TimerQueue> timers; // created on first use
 
 #ifdef NY_WithGl
 	GlxSetup glxSetup;
@@ -228,6 +231,23 @@ X11AppContext::X11AppContext()
 	// ewmh atoms
 	xcb_ewmh_init_atoms_replies(&ewmhConnection(), ewmhCookie, nullptr);
 
+	// present events are generic events that can only be identified by the opcode
+	auto presentExt = xcb_get_extension_data(xConnection_, &xcb_present_id);
+	if(presentExt && presentExt->present) impl_->presentOpcode = presentExt->major_opcode;
+
+	auto shmExt = xcb_get_extension_data(xConnection_, &xcb_shm_id);
+	if(shmExt && shmExt->present) impl_->shmEventBase = shmExt->first_event;
+
+	// eventfd used to wake up the dispatch loop, the callback only resets it
+	eventfd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(eventfd_ == -1)
+		throw std::runtime_error("ny::X11AppContext: failed to create eventfd");
+
+	fdCallback(eventfd_, POLLIN, [&](int, unsigned int){
+		int64_t v;
+		read(eventfd_, &v, 8);
+	});
+
 	// input
 	keyboardContext_ = std::make_unique<X11KeyboardContext>(*this);
 	mouseContext_ = std::make_unique<X11MouseContext>(*this);
@@ -245,6 +265,7 @@ X11AppContext::~X11AppContext()
 
 	if(xDummyWindow_) xcb_destroy_window(xConnection_, xDummyWindow_);
 	if(xDisplay_) ::XCloseDisplay(&xDisplay());
+	if(eventfd_ != -1) close(eventfd_);
 
 	xDisplay_ = nullptr;
 	xConnection_ = nullptr;
@@ -299,32 +320,139 @@ bool X11AppContext::dispatchEvents()
 {
 	if(!checkErrorWarn()) return false;
 
+	// trigger the fd callbacks that are ready without blocking
+	pollFds(0, 0);
+
 	xcb_flush(&xConnection());
-	while(auto event = xcb_poll_for_event(xConnection_)) {
-		processEvent(static_cast<const x11::GenericEvent&>(*event));
-		free(event);
-		xcb_flush(&xConnection());
-	}
+	while(dispatchBatch());
 
 	return checkErrorWarn();
 }
 
 bool X11AppContext::dispatchLoop(LoopControl& control)
 {
-	X11LoopImpl loopImpl(control, xConnection(), xDummyWindow());
+	X11LoopImpl loopImpl(control, eventfd_);
 
 	while(loopImpl.run.load()) {
-		while(auto func = loopImpl.popFunction()) func();
+		loopImpl.functions.run();
 
-		xcb_generic_event_t* event = xcb_wait_for_event(xConnection_);
-		if(!event && !checkErrorWarn()) return false;
+		// xcb might have already read events into its queue (e.g. while waiting
+		// for a reply) that would not wake up poll, so first handle all of them.
+		while(dispatchBatch());
 
-		processEvent(static_cast<const x11::GenericEvent&>(*event));
-		free(event);
+		if(!checkErrorWarn()) return false;
+		if(!loopImpl.run.load()) break;
+
+		// wait for the connection, the eventfd or any other registered fd
 		xcb_flush(&xConnection());
+		if(pollFds(POLLIN, -1) == -1) return false;
 	}
 
-	return true;
+	return checkErrorWarn();
+}
+
+unsigned int X11AppContext::dispatchBatch()
+{
+	// xcb_poll_for_event reads everything that is available from the connection,
+	// the following events are only taken from xcb's queue. So the batch is not
+	// extended by events read while processing it, they form the next batch.
+	// The batch is local since processing an event may dispatch nested batches
+	// (e.g. when waiting for a request or during a dnd operation).
+	std::vector<xcb_generic_event_t*> batch;
+	for(auto event = xcb_poll_for_event(xConnection_); event;
+			event = xcb_poll_for_queued_event(xConnection_)) {
+		batch.push_back(event);
+	}
+
+	if(batch.empty()) return 0u;
+
+	// the remaining events must be freed even if processing one of them throws
+	auto i = 0u;
+	auto freeGuard = nytl::makeScopeGuard([&]{
+		for(; i < batch.size(); ++i) free(batch[i]);
+	});
+
+	for(; i < batch.size(); ++i) {
+		processEvent(static_cast<const x11::GenericEvent&>(*batch[i]));
+		free(batch[i]);
+	}
+
+	// requests made while processing are sent together
+	xcb_flush(&xConnection());
+
+	auto size = static_cast<unsigned int>(batch.size());
+	++dispatchStats_.batches;
+	dispatchStats_.events += size;
+	dispatchStats_.lastBatch = size;
+	dispatchStats_.maxBatch = std::max(dispatchStats_.maxBatch, size);
+	return size;
+}
+
+nytl::Connection X11AppContext::timer(std::chrono::nanoseconds duration,
+	std::function<void()> func, bool repeat)
+{
+	// all timers share one timerfd that is polled like the other fds
+	if(!impl_->timers) {
+		impl_->timers = std::make_unique<TimerQueue>();
+		fdCallback(impl_->timers->fd(), POLLIN, [&](int, unsigned int){
+			impl_->timers->dispatch();
+		});
+	}
+
+	return impl_->timers->add(duration, std::move(func), repeat);
+}
+
+nytl::Connection X11AppContext::fdCallback(int fd, unsigned int events,
+	const FdCallbackFunc& func)
+{
+	return fdCallback(fd, events,
+		[f = func](nytl::Connection, int fd, unsigned int events){ f(fd, events); });
+}
+
+nytl::Connection X11AppContext::fdCallback(int fd, unsigned int events,
+	const FdCallbackFuncConn& func)
+{
+	return impl_->fdCallbacks.add({fd, events, func});
+}
+
+int X11AppContext::pollFds(short xEvents, int timeout)
+{
+	// The callbacks may disconnect themselves or other callbacks, i.e.
+	// impl_->fdCallbacks may change while triggering them.
+	// Therefore the connection ids are remembered and callbacks looked up again.
+	// See WaylandAppContext::pollFds for details.
+
+	std::vector<nytl::ConnectionID> ids;
+	std::vector<pollfd> fds;
+	ids.reserve(impl_->fdCallbacks.items.size());
+	fds.reserve(impl_->fdCallbacks.items.size() + 1);
+
+	for(auto& fdc : impl_->fdCallbacks.items) {
+		fds.push_back({fdc.fd, static_cast<short>(fdc.events), 0u});
+		ids.push_back({fdc.clID_});
+	}
+
+	// add the xcb connection fd to the pollfds
+	if(xEvents) fds.push_back({xcb_get_file_descriptor(xConnection_), xEvents, 0u});
+
+	auto ret = noSigPoll(*fds.data(), fds.size(), timeout);
+	if(ret < 0) {
+		ny_info("::xac::pollFds"_src, "poll failed: {}", std::strerror(errno));
+		return ret;
+	}
+
+	// check which fd callbacks have revents, find and trigger them
+	for(auto i = 0u; i < ids.size(); ++i) {
+		if(!fds[i].revents) continue;
+		for(auto& callback : impl_->fdCallbacks.items) {
+			if(callback.clID_ != ids[i]) continue;
+			nytl::Connection conn(impl_->fdCallbacks, callback.clID_);
+			callback.callback(conn, fds[i].fd, fds[i].revents);
+			break;
+		}
+	}
+
+	return ret;
 }
 
 bool X11AppContext::clipboard(std::unique_ptr<DataSource>&& dataSource)
@@ -445,6 +573,15 @@ void X11AppContext::processEvent(const x11::GenericEvent& ev)
 	X11EventData eventData {ev};
 
 	auto responseType = ev.response_type & ~0x80;
+
+	// extension events have no fixed response type
+	if(impl_->shmEventBase && responseType == impl_->shmEventBase + XCB_SHM_COMPLETION) {
+		auto& completion = reinterpret_cast<const xcb_shm_completion_event_t&>(ev);
+		auto wc = windowContext(completion.drawable);
+		if(wc) wc->shmCompletionEvent(completion.shmseg);
+		return;
+	}
+
 	switch(responseType) {
 		case XCB_EXPOSE: {
 			auto& expose = reinterpret_cast<const xcb_expose_event_t&>(ev);
@@ -483,6 +620,8 @@ void X11AppContext::processEvent(const x11::GenericEvent& ev)
 
 			auto wc = windowContext(configure.window);
 			if(wc) {
+				wc->configureEvent(nsize);
+
 				SizeEvent se;
 				se.eventData = &eventData;
 				se.size = nsize;
@@ -507,6 +646,18 @@ void X11AppContext::processEvent(const x11::GenericEvent& ev)
 			break;
 		}
 
+		case XCB_GE_GENERIC: {
+			auto& generic = reinterpret_cast<const xcb_ge_generic_event_t&>(ev);
+			if(!impl_->presentOpcode || generic.extension != impl_->presentOpcode) break;
+			if(generic.event_type != XCB_PRESENT_EVENT_COMPLETE_NOTIFY) break;
+
+			auto& complete = reinterpret_cast<const xcb_present_complete_notify_event_t&>(ev);
+			auto wc = windowContext(complete.window);
+			if(wc) wc->presentCompleteEvent(complete.serial);
+
+			break;
+		}
+
 	case 0u: {
 			int code = reinterpret_cast<const xcb_generic_error_t&>(ev).error_code;
 			auto errorMsg = x11::errorMessage(xDisplay(), code);
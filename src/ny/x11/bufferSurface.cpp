@@ -6,15 +6,25 @@
 #include <ny/x11/appContext.hpp>
 #include <ny/x11/util.hpp>
 #include <ny/log.hpp>
+#include <ny/event.hpp>
+#include <ny/windowListener.hpp>
 #include <nytl/vecOps.hpp>
 
 #include <xcb/xcb_image.h>
 #include <xcb/shm.h>
+#include <xcb/present.h>
+#include <xcb/xfixes.h>
+#include <xcb/render.h>
 
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <vector>
 
 // sources:
 // https://github.com/freedesktop-unofficial-mirror/xcb__util-image/blob/master/image/xcb_image.c#L158
@@ -29,15 +39,40 @@
 // we want to avoid additional overhead at resizing and since using it would make
 // the implementation (shm switch) even more complex.
 
-// When not using the shm version, we should have to check not to exceed the maximum
-// request length, but since this is usually pretty low (even with big requests extensions
-// somewhere around 4MB on test machine) band putting the image onto the window works
-// nontheless (somehow?!) and xcb-util-image does not check/split as well, so we don't check for
-// request length exceeding.
+// With shm, every buffer has its own segment and is not handed out again until the
+// server signaled that it is done with it (completion events for shm_put_image,
+// idle events for presented pixmaps), so drawing the next frame can overlap with the
+// server reading the last one.
+
+// When not using the shm version, the image data is sent with the put_image request
+// and therefore split into bands of rows so that every request stays within the
+// maximum request length (which is only a few MB even with the big requests extension).
+// Rows that don't fit into one request are split into columns.
+
+// When rendering at a different scale, the buffer is put onto an offscreen pixmap
+// that is then composited onto the window using the render extension with
+// a scaling transform. Presenting is not used then since the pixmap has to be
+// scaled anyways and Present cannot do that.
 
 namespace ny {
+namespace {
+
+// The size of the put_image request without its data in bytes.
+// It is 28 bytes, but with big requests the length field grows by 4 bytes.
+// Since requests near the maximum length are the ones that need big requests,
+// the larger size is always reserved.
+constexpr auto putImageHeader = 32u;
 
-X11BufferSurface::X11BufferSurface(X11WindowContext& wc) : windowContext_(&wc)
+// Converts to the 16.16 fixed point format used by the render extension.
+xcb_render_fixed_t toFixed(double value)
+{
+	return static_cast<xcb_render_fixed_t>(value * 65536.0);
+}
+
+} // anonymous util namespace
+
+X11BufferSurface::X11BufferSurface(X11WindowContext& wc, const BufferSurfaceSettings& settings)
+	: windowContext_(&wc)
 {
 	gc_ = xcb_generate_id(&xConnection());
 	std::uint32_t value[] = {0, 0};
@@ -64,6 +99,7 @@ X11BufferSurface::X11BufferSurface(X11WindowContext& wc) : windowContext_(&wc)
 	if(!fmt)
 		throw std::runtime_error("ny::X11BufferSurface: couldn't query depth format bpp");
 
+	scanlinePad_ = fmt->scanline_pad;
 	format_ = x11::visualToFormat(*windowContext().xVisualType(), fmt->bits_per_pixel);
 	if(format_ == ImageFormat::none)
 		throw std::runtime_error("ny::X11BufferSurface: couldn't parse visual format");
@@ -74,8 +110,30 @@ X11BufferSurface::X11BufferSurface(X11WindowContext& wc) : windowContext_(&wc)
 	auto reply = xcb_shm_query_version_reply(&xConnection(), cookie, nullptr);
 
 	shm_ = (reply);
-	if(reply) free(reply);
-	if(!shm_) ny_warn("::X11BufferSurface"_src, "shm server does not support shm extension");
+	auto sharedPixmaps = reply && reply->shared_pixmaps;
+	if(reply) {
+		// passing segments as file descriptors requires MIT-SHM 1.2
+		shmFd_ = reply->major_version > 1 || (reply->major_version == 1 &&
+			reply->minor_version >= 2);
+
+		#ifndef MFD_CLOEXEC
+			shmFd_ = false;
+		#endif
+		free(reply);
+	}
+
+	if(!shm_) {
+		ny_warn("::X11BufferSurface"_src, "shm server does not support shm extension");
+
+		// returns the length in 4 byte units, with big requests if the server supports it
+		maxRequestBytes_ = xcb_get_maximum_request_length(&xConnection()) * 4;
+	}
+	if(sharedPixmaps) initPresent();
+	buffers_.reserve(present_ ? maxPresentBuffers : maxShmBuffers);
+
+	if(settings.scale != 1.f && !renderScale(settings.scale)) {
+		ny_warn("::X11BufferSurface"_src, "render extension not supported, ignoring scale");
+	}
 }
 
 X11BufferSurface::~X11BufferSurface()
@@ -83,11 +141,311 @@ X11BufferSurface::~X11BufferSurface()
 	if(active_) ny_warn("::~X11BufferSurface"_src, "there is still an active BufferGuard");
 	if(gc_) xcb_free_gc(&xConnection(), gc_);
 
-	if(shmseg_) {
-		xcb_shm_detach(&xConnection(), shmseg_);
-		shmdt(data_);
-		shmctl(shmid_, IPC_RMID, 0);
+	for(auto& buffer : buffers_) destroy(buffer);
+	if(scalePicture_) xcb_render_free_picture(&xConnection(), scalePicture_);
+	if(scalePixmap_) xcb_free_pixmap(&xConnection(), scalePixmap_);
+	if(windowPicture_) xcb_render_free_picture(&xConnection(), windowPicture_);
+	if(idleEvents_) {
+		auto window = windowContext().xWindow();
+		xcb_present_select_input(&xConnection(), idleEventID_, window, 0);
+		xcb_present_select_input(&xConnection(), completeEventID_, window, 0);
+		xcb_unregister_for_special_event(&xConnection(), idleEvents_);
+	}
+}
+
+void X11BufferSurface::initPresent()
+{
+	auto& xconn = xConnection();
+	auto ext = xcb_get_extension_data(&xconn, &xcb_present_id);
+	if(!ext || !ext->present) return;
+
+	auto presentCookie = xcb_present_query_version(&xconn, XCB_PRESENT_MAJOR_VERSION,
+		XCB_PRESENT_MINOR_VERSION);
+	auto presentReply = xcb_present_query_version_reply(&xconn, presentCookie, nullptr);
+	if(!presentReply) return;
+	free(presentReply);
+
+	// xfixes is only needed to pass the damage as update region
+	auto fixesExt = xcb_get_extension_data(&xconn, &xcb_xfixes_id);
+	if(fixesExt && fixesExt->present) {
+		auto fixesCookie = xcb_xfixes_query_version(&xconn, XCB_XFIXES_MAJOR_VERSION,
+			XCB_XFIXES_MINOR_VERSION);
+		auto fixesReply = xcb_xfixes_query_version_reply(&xconn, fixesCookie, nullptr);
+		xfixes_ = (fixesReply) && fixesReply->major_version >= 2; // regions since 2.0
+		if(fixesReply) free(fixesReply);
+	}
+
+	// Idle events are received in an own queue so that we can wait for them in buffer()
+	// without dispatching other events. Complete events go through the AppContext
+	// since they should wake up its dispatch loop and trigger redraws.
+	auto window = windowContext().xWindow();
+	idleEventID_ = xcb_generate_id(&xconn);
+	completeEventID_ = xcb_generate_id(&xconn);
+	idleEvents_ = xcb_register_for_special_xge(&xconn, &xcb_present_id, idleEventID_, nullptr);
+	xcb_present_select_input(&xconn, idleEventID_, window,
+		XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+	xcb_present_select_input(&xconn, completeEventID_, window,
+		XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+
+	present_ = true;
+}
+
+bool X11BufferSurface::initRender()
+{
+	if(renderChecked_) return render_;
+	renderChecked_ = true;
+
+	auto& xconn = xConnection();
+	auto ext = xcb_get_extension_data(&xconn, &xcb_render_id);
+	if(!ext || !ext->present) return false;
+
+	// picture transforms and filters require render 0.6
+	auto versionCookie = xcb_render_query_version(&xconn, XCB_RENDER_MAJOR_VERSION,
+		XCB_RENDER_MINOR_VERSION);
+	auto versionReply = xcb_render_query_version_reply(&xconn, versionCookie, nullptr);
+	if(!versionReply) return false;
+
+	auto version = versionReply->major_version * 100 + versionReply->minor_version;
+	free(versionReply);
+	if(version < 6) return false;
+
+	// find the picture format of the windows visual
+	auto formatsCookie = xcb_render_query_pict_formats(&xconn);
+	auto formatsReply = xcb_render_query_pict_formats_reply(&xconn, formatsCookie, nullptr);
+	if(!formatsReply) return false;
+
+	auto visualID = windowContext().xVisualType()->visual_id;
+	xcb_render_pictformat_t format {};
+	auto screens = xcb_render_query_pict_formats_screens_iterator(formatsReply);
+	for(; screens.rem && !format; xcb_render_pictscreen_next(&screens)) {
+		auto depths = xcb_render_pictscreen_depths_iterator(screens.data);
+		for(; depths.rem && !format; xcb_render_pictdepth_next(&depths)) {
+			auto visuals = xcb_render_pictdepth_visuals_iterator(depths.data);
+			for(; visuals.rem; xcb_render_pictvisual_next(&visuals)) {
+				if(visuals.data->visual == visualID) {
+					format = visuals.data->format;
+					break;
+				}
+			}
+		}
+	}
+
+	free(formatsReply);
+	if(!format) return false;
+
+	pictFormat_ = format;
+	windowPicture_ = xcb_generate_id(&xconn);
+	xcb_render_create_picture(&xconn, windowPicture_, windowContext().xWindow(), format,
+		0, nullptr);
+
+	render_ = true;
+	return true;
+}
+
+X11BufferSurface::ShmSegment X11BufferSurface::createSegment(unsigned int size)
+{
+	auto& xconn = xConnection();
+
+	ShmSegment ret;
+	ret.size = size;
+	ret.seg = xcb_generate_id(&xconn);
+
+	// memfd segments don't count against the SysV limits and cannot be leaked
+	// since they are gone with the last reference to them.
+#ifdef MFD_CLOEXEC
+	if(shmFd_) {
+		auto fd = memfd_create("ny-x11-buffer", MFD_CLOEXEC);
+		if(fd != -1 && ftruncate(fd, size) == 0) {
+			auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(ptr != MAP_FAILED) {
+				ret.data = static_cast<uint8_t*>(ptr);
+				xcb_shm_attach_fd(&xconn, ret.seg, fd, 0); // closes fd
+				return ret;
+			}
+		}
+
+		if(fd != -1) close(fd);
+		ny_warn("::X11BufferSurface::createSegment"_src, "memfd failed, using SysV shm");
+		shmFd_ = false;
 	}
+#endif // MFD_CLOEXEC
+
+	ret.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+	if(ret.shmid == -1)
+		throw std::runtime_error("ny::X11BufferSurface: shmget failed");
+
+	auto ptr = shmat(ret.shmid, nullptr, 0);
+	if(ptr == reinterpret_cast<void*>(-1)) {
+		shmctl(ret.shmid, IPC_RMID, 0);
+		throw std::runtime_error("ny::X11BufferSurface: shmat failed");
+	}
+
+	// The id is removed as soon as the server has attached the segment so it
+	// is freed with the last detach, even if we crash. Checking the attach
+	// request waits until the server has processed it.
+	auto cookie = xcb_shm_attach_checked(&xconn, ret.seg, ret.shmid, 0);
+	x11::detail::countSyncRequest();
+	auto error = xcb_request_check(&xconn, cookie);
+	shmctl(ret.shmid, IPC_RMID, 0);
+	if(error) {
+		free(error);
+		shmdt(ptr);
+		throw std::runtime_error("ny::X11BufferSurface: xcb_shm_attach failed");
+	}
+
+	ret.data = static_cast<uint8_t*>(ptr);
+	return ret;
+}
+
+void X11BufferSurface::destroy(ShmSegment& segment)
+{
+	if(segment.seg) xcb_shm_detach(&xConnection(), segment.seg);
+	if(segment.shmid != -1) {
+		// the id was already removed after attaching, see createSegment
+		if(segment.data) shmdt(segment.data);
+	} else if(segment.data) {
+		munmap(segment.data, segment.size);
+	}
+
+	segment = {};
+}
+
+void X11BufferSurface::destroy(Buffer& buffer)
+{
+	if(buffer.pixmap) xcb_free_pixmap(&xConnection(), buffer.pixmap);
+	destroy(buffer.shm);
+	buffer = {};
+}
+
+void X11BufferSurface::processIdleEvents(bool wait)
+{
+	auto& xconn = xConnection();
+	auto event = wait ?
+		xcb_wait_for_special_event(&xconn, idleEvents_) :
+		xcb_poll_for_special_event(&xconn, idleEvents_);
+
+	while(event) {
+		auto& idle = reinterpret_cast<const xcb_present_idle_notify_event_t&>(*event);
+		if(idle.event_type == XCB_PRESENT_EVENT_IDLE_NOTIFY) {
+			for(auto& buffer : buffers_) {
+				if(buffer.pixmap == idle.pixmap) {
+					buffer.busy = false;
+					buffer.presented = false;
+				}
+			}
+		}
+
+		free(event);
+		event = xcb_poll_for_special_event(&xconn, idleEvents_);
+	}
+}
+
+void X11BufferSurface::waitPuts()
+{
+	// shm_put_image reads the segment while the request is processed, so after
+	// a round trip all puts are done. The completion events arrive later on and
+	// are harmless then.
+	x11::detail::countSyncRequest();
+	auto cookie = xcb_get_input_focus(&xConnection());
+	free(xcb_get_input_focus_reply(&xConnection(), cookie, nullptr));
+	for(auto& buffer : buffers_)
+		if(!buffer.presented) buffer.busy = false;
+}
+
+X11BufferSurface::Buffer& X11BufferSurface::shmBuffer(nytl::Vec2ui size, unsigned int byteSize)
+{
+	auto& xconn = xConnection();
+	if(present_) processIdleEvents(false);
+
+	Buffer* buffer {};
+	auto max = present_ ? maxPresentBuffers : maxShmBuffers;
+	while(!buffer) {
+		for(auto& b : buffers_) {
+			if(!b.busy) {
+				buffer = &b;
+				break;
+			}
+		}
+
+		if(buffer) break;
+		if(buffers_.size() < max) {
+			buffers_.emplace_back();
+			buffer = &buffers_.back();
+			break;
+		}
+
+		// all buffers are still used by the server, we have to wait
+		xcb_flush(&xconn);
+		if(xcb_connection_has_error(&xconn))
+			throw std::runtime_error("ny::X11BufferSurface: connection error");
+
+		// buffers that were presented are only released by idle events
+		auto presented = std::any_of(buffers_.begin(), buffers_.end(),
+			[](auto& b) { return b.presented; });
+		if(presented) processIdleEvents(true);
+		else waitPuts();
+	}
+
+	if(buffer->shm.size < byteSize) {
+		if(buffer->pixmap) xcb_free_pixmap(&xconn, buffer->pixmap);
+		buffer->pixmap = {};
+		destroy(buffer->shm);
+
+		buffer->shm = createSegment(byteSize);
+	}
+
+	if(present_ && (buffer->size != size || !buffer->pixmap)) {
+		if(buffer->pixmap) xcb_free_pixmap(&xconn, buffer->pixmap);
+		buffer->pixmap = xcb_generate_id(&xconn);
+		xcb_shm_create_pixmap(&xconn, buffer->pixmap, windowContext().xWindow(), size[0],
+			size[1], windowContext().visualDepth(), buffer->shm.seg, 0);
+	}
+
+	buffer->size = size;
+	return *buffer;
+}
+
+void X11BufferSurface::presentActive(const BufferGuard& guard) noexcept
+{
+	auto& xconn = xConnection();
+	auto& buffer = *activeBuffer_;
+
+	// only the update region is copied onto the window
+	uint32_t region {};
+	if(!guard.fullDamage() && xfixes_) {
+		std::vector<xcb_rectangle_t> rects;
+		rects.reserve(guard.damage().size());
+		for(auto& rect : guard.damage()) {
+			rects.push_back({static_cast<int16_t>(rect.position[0]),
+				static_cast<int16_t>(rect.position[1]), static_cast<uint16_t>(rect.size[0]),
+				static_cast<uint16_t>(rect.size[1])});
+		}
+
+		region = xcb_generate_id(&xconn);
+		xcb_xfixes_create_region(&xconn, region, rects.size(), rects.data());
+	}
+
+	// target msc 0 with divisor 0 means: at the next vblank
+	xcb_present_pixmap(&xconn, windowContext().xWindow(), buffer.pixmap, ++serial_,
+		0, region, 0, 0, 0, 0, 0, XCB_PRESENT_OPTION_NONE, 0, 0, 0, 0, nullptr);
+	if(region) xcb_xfixes_destroy_region(&xconn, region);
+	xcb_flush(&xconn);
+
+	buffer.busy = true;
+	buffer.presented = true;
+	framePending_ = true;
+}
+
+bool X11BufferSurface::completed(uint32_t serial)
+{
+	if(serial == serial_) framePending_ = false;
+	return !framePending_;
+}
+
+void X11BufferSurface::shmCompleted(uint32_t shmseg)
+{
+	for(auto& buffer : buffers_)
+		if(buffer.shm.seg == shmseg && !buffer.presented) buffer.busy = false;
 }
 
 BufferGuard X11BufferSurface::buffer()
@@ -95,42 +453,64 @@ BufferGuard X11BufferSurface::buffer()
 	if(active_)
 		throw std::logic_error("ny::X11BufferSurface::buffer: there is already a BufferGuard");
 
-	//check if resize is needed
-	auto size = windowContext().size();
-	auto newBytes = std::ceil(size[0] * size[1] * bitSize(format_) / 8.0); //the needed size
-	if(newBytes > byteSize_) {
-		// we alloc more than is really needed because this will
-		// speed up (especially the shm version) resizes. We don't have to reallocated
-		// every time the window is resized and redrawn for the cost of higher memory
-		// consumption
-		byteSize_ = newBytes * 4;
-
-		if(shm_) {
-			if(shmseg_) {
-				xcb_shm_detach(&xConnection(), shmseg_);
-				shmdt(data_);
-				shmctl(shmid_, IPC_RMID, 0);
-			} else {
-				shmseg_ = xcb_generate_id(&xConnection());
-			}
+	// the scale pixmap is the target for put requests while scaling
+	auto& xconn = xConnection();
+	auto windowSize = windowContext().size();
+	auto size = windowSize;
+	if(scale_ != 1.f) {
+		size[0] = std::max(std::lround(windowSize[0] * scale_), 1l);
+		size[1] = std::max(std::lround(windowSize[1] * scale_), 1l);
+	}
+
+	scaled_ = size != windowSize;
+	if(scaled_ && scaleSize_ != size) {
+		if(scalePicture_) xcb_render_free_picture(&xconn, scalePicture_);
+		if(scalePixmap_) xcb_free_pixmap(&xconn, scalePixmap_);
+
+		scalePixmap_ = xcb_generate_id(&xconn);
+		xcb_create_pixmap(&xconn, windowContext().visualDepth(), scalePixmap_,
+			windowContext().xWindow(), size[0], size[1]);
 
-			shmid_ = shmget(IPC_PRIVATE, byteSize_, IPC_CREAT | 0777);
-			data_ = static_cast<uint8_t*>(shmat(shmid_, 0, 0));
-			shmseg_ = xcb_generate_id(&xConnection());
-			xcb_shm_attach(&xConnection(), shmseg_, shmid_, 0);
-		} else {
+		static constexpr char filter[] = "bilinear";
+		scalePicture_ = xcb_generate_id(&xconn);
+		xcb_render_create_picture(&xconn, scalePicture_, scalePixmap_, pictFormat_, 0, nullptr);
+		xcb_render_set_picture_filter(&xconn, scalePicture_, sizeof(filter) - 1, filter,
+			0, nullptr);
+		scaleSize_ = size;
+	}
+
+	auto stride = static_cast<unsigned int>(align(size[0] * bitSize(format_), scanlinePad_));
+	auto newBytes = (stride * size[1] + 7) / 8;
+
+	uint8_t* data;
+	if(shm_) {
+		activeBuffer_ = &shmBuffer(size, newBytes);
+		data = activeBuffer_->shm.data;
+	} else {
+		if(newBytes > byteSize_) {
+			byteSize_ = newBytes * 2;
 			ownedBuffer_ = std::make_unique<uint8_t[]>(byteSize_);
-			data_ = ownedBuffer_.get();
 		}
+
+		data = ownedBuffer_.get();
 	}
 
 	size_ = size;
+	windowSize_ = windowSize;
 	active_ = true;
 
-	return {*this, {data_, {size_[0], size_[1]}, format_, size_[0] * bitSize(format_)}};
+	return {*this, {data, {size_[0], size_[1]}, format_, stride}, 0u, windowSize};
+}
+
+bool X11BufferSurface::renderScale(float scale)
+{
+	if(!BufferSurface::renderScale(scale) && !initRender()) return false;
+
+	scale_ = scale;
+	return true;
 }
 
-void X11BufferSurface::apply(const BufferGuard&) noexcept
+void X11BufferSurface::apply(const BufferGuard& guard) noexcept
 {
 	if(!active_) {
 		ny_warn("::X11BufferSurface::apply"_src, "no currently active BufferGuard");
@@ -138,29 +518,131 @@ void X11BufferSurface::apply(const BufferGuard&) noexcept
 	}
 
 	active_ = false;
+	if(present_ && !scaled_) {
+		presentActive(guard);
+	} else if(guard.fullDamage()) {
+		put(guard.get(), {{0u, 0u}, size_}, true);
+	} else {
+		auto& damage = guard.damage();
+		for(auto i = 0u; i < damage.size(); ++i)
+			put(guard.get(), damage[i], i + 1 == damage.size());
 
-	// XXX: we use the checked versions here since those function are very error prone due to
-	// the rather complex depth/visual/bpp x system. We catch invalid x request here
-	// directly.
-	// maybe remove this later on if tested enough?
+		// nothing was put, the buffer is not used by the server
+		if(damage.empty() && activeBuffer_) activeBuffer_->busy = false;
+	}
+
+	if(scaled_) compositeScaled(guard);
+	activeBuffer_ = nullptr;
+}
+
+void X11BufferSurface::compositeScaled(const BufferGuard& guard) noexcept
+{
+	auto& xconn = xConnection();
+
+	// the transform maps window coordinates to pixmap coordinates
+	auto sx = size_[0] / static_cast<double>(windowSize_[0]);
+	auto sy = size_[1] / static_cast<double>(windowSize_[1]);
+	xcb_render_transform_t transform {
+		toFixed(sx), 0, 0,
+		0, toFixed(sy), 0,
+		0, 0, toFixed(1.0)
+	};
+	xcb_render_set_picture_transform(&xconn, scalePicture_, transform);
+
+	auto composite = [&](int x, int y, int width, int height) {
+		xcb_render_composite(&xconn, XCB_RENDER_PICT_OP_SRC, scalePicture_, XCB_NONE,
+			windowPicture_, x, y, 0, 0, x, y, width, height);
+	};
+
+	if(guard.fullDamage()) {
+		composite(0, 0, windowSize_[0], windowSize_[1]);
+	} else {
+		// scale the damage to window coordinates, the bilinear filter
+		// also affects the neighbor pixels
+		for(auto& rect : guard.damage()) {
+			auto x1 = std::max(std::floor(rect.position[0] / sx) - 1, 0.0);
+			auto y1 = std::max(std::floor(rect.position[1] / sy) - 1, 0.0);
+			auto x2 = std::min(std::ceil((rect.position[0] + rect.size[0]) / sx) + 1,
+				double(windowSize_[0]));
+			auto y2 = std::min(std::ceil((rect.position[1] + rect.size[1]) / sy) + 1,
+				double(windowSize_[1]));
+			if(x2 <= x1 || y2 <= y1) continue;
+			composite(x1, y1, x2 - x1, y2 - y1);
+		}
+	}
+
+	xcb_flush(&xconn);
+}
+
+void X11BufferSurface::put(const Image& img, const nytl::Rect2ui& rect, bool last) noexcept
+{
+	// We don't use the checked versions of the put requests here since checking them
+	// would mean a round trip for every frame. The format is validated in the
+	// constructor and errors will still be reported when the AppContext
+	// receives them as events.
 
 	auto depth = windowContext().visualDepth();
-	auto window = windowContext().xWindow();
+	auto drawable = scaled_ ? scalePixmap_ : windowContext().xWindow();
+	auto x = rect.position[0];
+	auto y = rect.position[1];
+	auto width = rect.size[0];
+	auto height = rect.size[1];
+
 	if(shm_) {
-		auto cookie = xcb_shm_put_image_checked(&xConnection(), window, gc_, size_[0], size_[1],
-			0, 0, size_[0], size_[1], 0, 0, depth, XCB_IMAGE_FORMAT_Z_PIXMAP, 0, shmseg_, 0);
-		windowContext().errorCategory().checkWarn(cookie, "ny::X11BufferSurface: shm_put_image");
-	} else {
-		auto length = std::ceil(size_[0] * size_[1] * bitSize(format_) / 8.0);
-		auto cookie = xcb_put_image_checked(&xConnection(), XCB_IMAGE_FORMAT_Z_PIXMAP, window,
-			gc_, size_[0], size_[1], 0, 0, 0, depth, length, data_);
-		windowContext().errorCategory().checkWarn(cookie, "ny::X11BufferSurface: put_image");
+		// the server reads the rect directly out of the shared segment.
+		// The buffer is not used again before the completion event for the
+		// last put arrived.
+		auto& buffer = *activeBuffer_;
+		xcb_shm_put_image(&xConnection(), drawable, gc_, size_[0], size_[1],
+			x, y, width, height, x, y, depth, XCB_IMAGE_FORMAT_Z_PIXMAP, last,
+			buffer.shm.seg, 0);
+		if(last) buffer.busy = true;
+		return;
+	}
+
+	// put_image expects the rows of the rect to be tightly packed (with scanline pad).
+	// Only rects spanning the whole width already are, others are copied first.
+	auto stride = static_cast<unsigned int>(align(width * bitSize(format_), scanlinePad_));
+
+	// without big requests a single row of a wide window might not fit into
+	// one request, split it into columns then
+	if(stride / 8 + putImageHeader > maxRequestBytes_ && width > 1) {
+		auto half = width / 2;
+		put(img, {{x, y}, {half, height}}, last);
+		put(img, {{x + half, y}, {width - half, height}}, last);
+		return;
+	}
+
+	const uint8_t* rows = data(img) + y * bitStride(img) / 8;
+	if(width != size_[0]) {
+		auto packedSize = stride / 8 * height;
+		if(packed_.size() < packedSize) packed_.resize(packedSize);
+
+		try {
+			MutableImage packed {packed_.data(), {width, height}, format_, stride};
+			copy(subImage(img, rect), packed);
+		} catch(const std::exception& err) {
+			ny_warn("::X11BufferSurface::put"_src, "copying the rect failed: {}", err.what());
+			return;
+		}
+
+		rows = packed_.data();
+	}
+
+	// split the rect into bands of rows that fit into one request each.
+	// They are not checked, so they are just pipelined.
+	auto rowBytes = stride / 8;
+	auto bandRows = std::max((maxRequestBytes_ - putImageHeader) / rowBytes, 1u);
+	for(auto band = 0u; band < height; band += bandRows) {
+		auto bandHeight = std::min(bandRows, height - band);
+		xcb_put_image(&xConnection(), XCB_IMAGE_FORMAT_Z_PIXMAP, drawable, gc_, width,
+			bandHeight, x, y + band, 0, depth, rowBytes * bandHeight, rows + band * rowBytes);
 	}
 }
 
 // X11BufferWindowContext
 X11BufferWindowContext::X11BufferWindowContext(X11AppContext& ac, const X11WindowSettings& settings)
-	: X11WindowContext(ac, settings), bufferSurface_(*this)
+	: X11WindowContext(ac, settings), bufferSurface_(*this, settings.buffer)
 {
 	if(settings.buffer.storeSurface) *settings.buffer.storeSurface = &bufferSurface_;
 }
@@ -170,4 +652,30 @@ Surface X11BufferWindowContext::surface()
 	return {bufferSurface_};
 }
 
+void X11BufferWindowContext::refresh()
+{
+	// like on wayland, when presenting we wait for the last frame to be completed
+	if(bufferSurface_.framePending()) {
+		refreshFlag_ = true;
+		return;
+	}
+
+	X11WindowContext::refresh();
+}
+
+void X11BufferWindowContext::presentCompleteEvent(uint32_t serial)
+{
+	if(bufferSurface_.completed(serial) && refreshFlag_) {
+		refreshFlag_ = false;
+
+		DrawEvent de {};
+		listener().draw(de);
+	}
+}
+
+void X11BufferWindowContext::shmCompletionEvent(uint32_t shmseg)
+{
+	bufferSurface_.shmCompleted(shmseg);
+}
+
 } // namespace ny
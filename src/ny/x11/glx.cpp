@@ -493,9 +493,10 @@ GlxWindowContext::GlxWindowContext(X11AppContext& ac, const GlxSetup& setup,
 
 	auto configid = settings.gl.config;
 	if(!configid) {
-		if(settings.transparent) configid = setup.defaultTransparentConfig().id;
+		auto transparent = settings.transparent && !settings.opaque;
+		if(transparent) configid = setup.defaultTransparentConfig().id;
 		if(!configid) {
-			if(settings.transparent)
+			if(transparent)
 				ny_warn("::glx::WindowContext"_src, "no transparent config");
 			configid = setup.defaultConfig().id;
 		}
@@ -14,6 +14,7 @@
 #include <unordered_map> // std::unordered_map
 #include <shared_mutex> // std::shared_timed_mutex
 #include <mutex> // std::lock_guard
+#include <atomic> // std::atomic
 
 namespace ny {
 
@@ -129,6 +130,7 @@ std::error_code X11ErrorCategory::errorCode(int error) const
 
 std::error_code X11ErrorCategory::check(xcb_void_cookie_t cookie) const
 {
+	x11::detail::countSyncRequest();
 	auto e = xcb_request_check(xConnection_, cookie);
 	if(e) {
 		auto code = std::error_code(e->error_code, *this);
@@ -141,6 +143,7 @@ std::error_code X11ErrorCategory::check(xcb_void_cookie_t cookie) const
 
 bool X11ErrorCategory::check(xcb_void_cookie_t cookie, std::error_code& ec) const
 {
+	x11::detail::countSyncRequest();
 	auto e = xcb_request_check(xConnection_, cookie);
 	if(e) {
 		ec = {e->error_code, *this};
@@ -153,6 +156,7 @@ bool X11ErrorCategory::check(xcb_void_cookie_t cookie, std::error_code& ec) cons
 
 bool X11ErrorCategory::checkWarn(xcb_void_cookie_t cookie, nytl::StringParam msg) const
 {
+	x11::detail::countSyncRequest();
 	auto e = xcb_request_check(xConnection_, cookie);
 	if(e) {
 		auto errorMsg = x11::errorMessage(*xDisplay_, e->error_code);
@@ -272,5 +276,23 @@ unsigned int visualDepth(xcb_screen_t& screen, unsigned int visualID)
 	return 0u;
 }
 
+namespace {
+	std::atomic<unsigned int> syncRequests {};
+}
+
+unsigned int syncRequestCount()
+{
+	return syncRequests.load(std::memory_order_relaxed);
+}
+
+namespace detail {
+
+void countSyncRequest()
+{
+	syncRequests.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace detail
+
 } // namespace x11
 } // namespace ny
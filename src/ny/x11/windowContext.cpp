@@ -127,6 +127,7 @@ void X11WindowContext::createWindow(const X11WindowSettings& settings)
 		size[0], size[1], 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, vid, valuemask, valuelist);
 	errorCategory().checkThrow(cookie, "ny::X11WindowContext: create_window failed");
 	xWindow_ = window;
+	size_ = size;
 }
 
 void X11WindowContext::initVisual(const X11WindowSettings& settings)
@@ -137,26 +138,30 @@ void X11WindowContext::initVisual(const X11WindowSettings& settings)
 
 	visualID_ = 0u;
 	auto& screen = appContext().xDefaultScreen();
-	auto avDepth = 0u;
 
+	// opaque windows always use a 24 bit visual (if available) so that a
+	// compositor knows that it does not have to blend them
+	auto has24 = false;
+	auto has32 = false;
 	auto depth_iter = xcb_screen_allowed_depths_iterator(&screen);
 	for(; depth_iter.rem; xcb_depth_next(&depth_iter)) {
-		if(depth_iter.data->depth == 32) {
-			avDepth = 32;
-			if(settings.transparent) break;
-		}
-
-		if(!avDepth && depth_iter.data->depth == 24) {
-			avDepth = 24;
-			if(!settings.transparent) break;
-		}
+		if(depth_iter.data->depth == 32) has32 = true;
+		else if(depth_iter.data->depth == 24) has24 = true;
 	}
 
+	auto transparent = settings.transparent && !settings.opaque;
+	if(settings.transparent && settings.opaque)
+		ny_warn("window is both transparent and opaque, using opaque");
+
+	auto avDepth = 0u;
+	if(transparent) avDepth = has32 ? 32 : has24 ? 24 : 0;
+	else avDepth = has24 ? 24 : has32 ? 32 : 0;
+
 	if(avDepth == 0u)
 		throw std::runtime_error(novis);
-	else if(settings.transparent && avDepth == 24)
+	else if(transparent && avDepth == 24)
 		ny_warn("transparent window but no 32 bit visual");
-	else if(!settings.transparent && avDepth == 32)
+	else if(!transparent && avDepth == 32)
 		ny_info("not-transparent window, but only 32 bits visuals");
 
 	// argb > rgba > bgra for 32
@@ -181,7 +186,10 @@ void X11WindowContext::initVisual(const X11WindowSettings& settings)
 		auto visual_iter = xcb_depth_visuals_iterator(depth_iter.data);
 		for(; visual_iter.rem; xcb_visualtype_next(&visual_iter)) {
 			auto format = x11::visualToFormat(*visual_iter.data, avDepth);
-			if(score(format) > highestScore) visualID_ = visual_iter.data->visual_id;
+			if(score(format) > highestScore) {
+				highestScore = score(format);
+				visualID_ = visual_iter.data->visual_id;
+			}
 		}
 
 		break;
@@ -230,6 +238,9 @@ void X11WindowContext::hide()
 
 void X11WindowContext::size(nytl::Vec2ui size)
 {
+	// the window manager might not allow the new size but then it will
+	// send a configure event that corrects it
+	size_ = size;
 	xcb_configure_window(&xConnection(), xWindow_,
 		XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, size.data());
 	refresh();
@@ -458,6 +469,11 @@ void X11WindowContext::reparentEvent()
 	position(settings_.position);
 }
 
+void X11WindowContext::configureEvent(nytl::Vec2ui size)
+{
+	size_ = size;
+}
+
 void X11WindowContext::customDecorated(bool set)
 {
 	typedef struct {
@@ -586,13 +602,19 @@ void X11WindowContext::overrideRedirect(bool redirect)
 	xcb_change_window_attributes(&xConnection(), xWindow(), XCB_CW_OVERRIDE_REDIRECT, &data);
 }
 
-nytl::Vec2ui X11WindowContext::size() const
+nytl::Vec2ui X11WindowContext::querySize()
 {
+	x11::detail::countSyncRequest();
 	auto cookie = xcb_get_geometry(&xConnection(), xWindow());
 	auto geometry = xcb_get_geometry_reply(&xConnection(), cookie, nullptr);
-	auto ret = nytl::Vec2ui{geometry->width, geometry->height};
+	if(!geometry) {
+		ny_warn("::xwc::querySize"_src, "get_geometry failed");
+		return size_;
+	}
+
+	size_ = {geometry->width, geometry->height};
 	std::free(geometry);
-	return ret;
+	return size_;
 }
 
 xcb_visualtype_t* X11WindowContext::xVisualType() const